@@ -0,0 +1,44 @@
+/*
+* grf2bin
+* Converts a graph from the .grf text format, or from another format of GraphFormats.hpp,
+* to a binary graph file (see GraphFile.hpp), which the matchers load by mapping it in memory.
+*/
+#include <stdio.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+
+#include "ARGLoader.hpp"
+#include "ARGraph.hpp"
+#include "GraphFile.hpp"
+#include "GraphFormats.hpp"
+
+using namespace vflib;
+
+typedef int32_t data_t;
+
+int32_t main(int32_t argc, char** argv)
+{
+	if (argc < 3)
+	{
+		std::cout << "Usage: grf2bin [graph] [output] [num of threads (opt)]";
+		std::cout << " [format auto|grf|edgelist|mtx|lad|mivia16|mivia32 (opt)]\n";
+		return -1;
+	}
+
+	int numOfThreads = argc > 3 ? atoi(argv[3]) : 0;
+	GraphFormat format = FORMAT_AUTO;
+	if (argc > 4 && !ParseGraphFormat(argv[4], format))
+	{
+		std::cout << "Invalid format " << argv[4] << "\n";
+		return -1;
+	}
+
+	//The graphs worth converting are the large ones, thus the .grf loader sparing memory is used
+	ARGraph<data_t, Empty> *graph = LoadGraph<data_t, Empty>(argv[1], format, numOfThreads, true);
+	GraphFile<data_t, Empty>::Write(*graph, argv[2]);
+
+	std::cout << graph->NodeCount() << " nodes, " << graph->OutEdgeCount() << " edges\n";
+	delete graph;
+	return 0;
+}
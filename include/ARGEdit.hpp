@@ -10,6 +10,9 @@
 #ifndef ARGEDIT_H
 #define ARGEDIT_H
 
+#include <algorithm>
+#include <vector>
+
 #include <Error.hpp>
 #include <ARGraph.hpp>
 
@@ -19,10 +22,13 @@ namespace vflib
 	/**
 	 * @class ARGEdit
 	 * @brief A simple ARGLoader providing graph edit operations.
-	 *	Nodes are stored as a linked list and each node stores the list of its out going edges.
-	 * @note The ARGEdit does not make provisions for the
-	 *       deallocation of the attributes, which must be
-	 *       dealt with by the programmer.
+	 *	Node attributes are stored in a vector and edges in a flat list. Inserted edges
+	 *	are appended to the list, which is sorted by start and end node, and indexed by
+	 *	start node, on the first read following the insertions; thus building a graph
+	 *	costs O(E log E), or O(n + E) when the edges are inserted in order.
+	 *	Deleting a node or an edge costs O(n + E).
+	 * @note Inserting an edge already in the graph is reported when the edges are
+	 *	sorted, that is on the first read following the insertion.
 	 */
 	template<typename Node, typename Edge>
 	class ARGEdit : public ARGLoader<Node, Edge>
@@ -32,7 +38,6 @@ namespace vflib
 		ARGEdit();
 		ARGEdit(ARGraph<Node, Edge> &g);
 		ARGEdit(ARGLoader<Node, Edge> &g);
-		~ARGEdit();
 
 		/* Redefined ARGLoader methods */
 		virtual uint32_t NodeCount() const;
@@ -49,35 +54,27 @@ namespace vflib
 	protected:
 		uint32_t count; /**<Number of nodes */
 
-	  /**
-	  * @brief Structure of an edge used from the ARGEdit.
-	  * @note Edges are stored as a linked list.
-	  */
+		/**
+		* @brief Structure of an edge used from the ARGEdit.
+		*/
 		struct eNode
 		{
 			nodeID_t from;	/**<Start node id */
 			nodeID_t to;	/**<End node id */
-			uint32_t pos;		/**<Current position */
 			Edge attr;	/**<Edge attribute */
-			eNode *next;	/**<Next edge structure of the list */
-		};
 
-		/**
-		* @brief Structure of a node used from the ARGEdit.
-		* @note Node are stored as a linked list.
-		*/
-		struct nNode
-		{
-			nodeID_t id;	/**<Node id */
-			uint32_t count;	/**<Number of edges out going from the node */
-			Node attr;	/**<Attribute of the node */
-			nNode *next;	/**<Next node structure of the list*/
-			eNode *edges;	/**<List of out going edges of the node */
+			bool operator<(const eNode &e) const
+			{
+				return from < e.from || (from == e.from && to < e.to);
+			}
 		};
 
-		nNode *nodes;		/**<List of nodes */
-		nNode *lastNode;	/**<Last inserted node */
-		eNode *lastEdge;	/**<Last inserted edge */
+		AttrVector<Node> attrs;				/**<Node attributes */
+		mutable std::vector<eNode> edges;	/**<Edges, sorted by start and end node when indexed */
+		mutable std::vector<uint32_t> offset;	/**<Start of the edges of each node, n+1 entries when indexed */
+		mutable bool indexed;				/**<The edges are sorted and offset is up to date */
+
+		void Index() const;
 	};
 
 	/**
@@ -87,9 +84,7 @@ namespace vflib
 	ARGEdit<Node, Edge>::ARGEdit()
 	{
 		count = 0;
-		nodes = NULL;
-		lastNode = NULL;
-		lastEdge = NULL;
+		indexed = false;
 	}
 
 	/**
@@ -101,21 +96,21 @@ namespace vflib
 	ARGEdit<Node, Edge>::ARGEdit(ARGraph<Node, Edge> &g)
 	{
 		count = 0;
-		nodes = NULL;
-		lastNode = NULL;
-		lastEdge = NULL;
+		indexed = false;
 		uint32_t i;
 		nodeID_t n;
 
+		attrs.reserve(g.NodeCount());
 		for (n = 0; n < g.NodeCount(); n++)
 			InsertNode(g.GetNodeAttr(n));
-		
+
+		edges.reserve(g.OutEdgeCount());
 		for (n = 0; n < g.NodeCount(); n++)
 		{
 			for (i = 0; i < g.OutEdgeCount(n); i++)
 			{
-				void *attr;
-				nodeID_t n2 = g.GetOutEdge(n, i, &attr);
+				Edge attr;
+				nodeID_t n2 = g.GetOutEdge(n, i, attr);
 				InsertEdge(n, n2, attr);
 			}
 		}
@@ -130,50 +125,50 @@ namespace vflib
 	ARGEdit<Node, Edge>::ARGEdit(ARGLoader<Node, Edge> &g)
 	{
 		count = 0;
-		nodes = NULL;
-		lastNode = NULL;
-		lastEdge = NULL;
+		indexed = false;
 		uint32_t i;
 		nodeID_t n;
 
+		attrs.reserve(g.NodeCount());
 		for (n = 0; n < g.NodeCount(); n++)
-			InsertNode(g.GetNodeAttr(n));
-		
+		{
+			Node attr = g.GetNodeAttr(n);
+			InsertNode(attr);
+		}
+
 		for (n = 0; n < g.NodeCount(); n++)
 		{
 			for (i = 0; i < g.OutEdgeCount(n); i++)
 			{
-				Edge *attr;
+				Edge attr;
 				nodeID_t n2 = g.GetOutEdge(n, i, &attr);
 				InsertEdge(n, n2, attr);
 			}
 		}
 	}
 
-
 	/**
-	* @brief Destructor
+	* @brief Sorts the edges and computes the offsets of the nodes, if needed.
 	*/
 	template<typename Node, typename Edge>
-	ARGEdit<Node, Edge>::~ARGEdit()
+	void ARGEdit<Node, Edge>::Index() const
 	{
-		nNode *pn, *pn1;
-		eNode *pe, *pe1;
+		if (indexed)
+			return;
+
+		if (!std::is_sorted(edges.begin(), edges.end()))
+			std::stable_sort(edges.begin(), edges.end());
 
-		pn = nodes;
-		while (pn != NULL)
+		offset.assign(count + 1, 0);
+		for (size_t e = 0; e < edges.size(); e++)
 		{
-			pe = pn->edges;
-			while (pe != NULL)
-			{
-				pe1 = pe;
-				pe = pe->next;
-				delete pe1;
-			}
-			pn1 = pn;
-			pn = pn->next;
-			delete pn1;
+			if (e > 0 && edges[e].from == edges[e - 1].from && edges[e].to == edges[e - 1].to)
+				error("Bad param 2 in ARGEdit::InsertEdge: %d", (int)edges[e].to);
+			offset[edges[e].from + 1]++;
 		}
+		for (nodeID_t n = 0; n < count; n++)
+			offset[n + 1] += offset[n];
+		indexed = true;
 	}
 
 	/**
@@ -194,15 +189,9 @@ namespace vflib
 	template<typename Node, typename Edge>
 	Node ARGEdit<Node, Edge>::GetNodeAttr(nodeID_t id)
 	{
-		nNode *n = nodes;
-		if (lastNode != NULL && lastNode->id <= id)
-			n = lastNode;
-
-		while (n != NULL && n->id != id)
-			n = n->next;
-		if (n == NULL)
+		if (id >= count)
 			error("Inconsistent data");
-		return n->attr;
+		return attrs[id];
 	}
 
 	/**
@@ -213,15 +202,10 @@ namespace vflib
 	template<typename Node, typename Edge>
 	uint32_t ARGEdit<Node, Edge>::OutEdgeCount(nodeID_t id) const
 	{
-		nNode *n = nodes;
-		if (lastNode != NULL && lastNode->id <= id)
-			n = lastNode;
-
-		while (n != NULL && n->id != id)
-			n = n->next;
-		if (n == NULL)
+		if (id >= count)
 			error("Inconsistent data");
-		return n->count;
+		Index();
+		return offset[id + 1] - offset[id];
 	}
 
 	/**
@@ -234,41 +218,16 @@ namespace vflib
 	template<typename Node, typename Edge>
 	nodeID_t ARGEdit<Node, Edge>::GetOutEdge(nodeID_t id, uint32_t i, Edge *pattr)
 	{
-		nNode *n = nodes;
-		if (lastNode != NULL && lastNode->id <= id)
-			n = lastNode;
-
-		while (n != NULL && n->id != id)
-			n = n->next;
-		if (n == NULL)
+		if (id >= count)
 			error("Inconsistent data");
-
-		eNode *e = n->edges;
-		uint32_t pos = 0;
-
-		if (lastEdge != NULL && lastEdge->from == id &&
-			lastEdge->pos >= 0 && lastEdge->pos <= i)
-		{
-			e = lastEdge;
-			pos = e->pos;
-		}
-
-		while (e != NULL && pos < i)
-		{
-			e->pos = pos;
-			e = e->next;
-			pos++;
-		}
-
-		if (e == NULL)
+		Index();
+		if (i >= offset[id + 1] - offset[id])
 			error("Inconsistent data");
 
+		const eNode &e = edges[offset[id] + i];
 		if (pattr != NULL)
-			*pattr = e->attr;
-		lastNode = n;
-		lastEdge = e;
-
-		return e->to;
+			*pattr = e.attr;
+		return e.to;
 	}
 
 
@@ -280,40 +239,9 @@ namespace vflib
 	template<typename Node, typename Edge>
 	nodeID_t ARGEdit<Node, Edge>::InsertNode(Node& attr)
 	{
-		nNode *n = new nNode;
-		if (n == NULL)
-			error("Out of memory");
-		nodeID_t id = n->id = count++;
-		n->attr = attr;
-		n->edges = NULL;
-		n->count = 0;
-
-		nNode *p = nodes, *p0 = NULL;
-		if (lastNode != NULL && lastNode->id < id)
-		{
-			p0 = lastNode;
-			p = lastNode->next;
-		}
-		while (p != NULL && p->id < id)
-		{
-			p0 = p;
-			p = p->next;
-		}
-
-
-		if (p0 == NULL)
-		{
-			n->next = nodes;
-			nodes = n;
-		}
-		else
-		{
-			n->next = p0->next;
-			p0->next = n;
-		}
-		lastNode = n;
-
-		return n->id;
+		attrs.push_back(attr);
+		indexed = false;
+		return count++;
 	}
 
 	/**
@@ -325,56 +253,18 @@ namespace vflib
 	template<typename Node, typename Edge>
 	void ARGEdit<Node, Edge>::InsertEdge(nodeID_t id1, nodeID_t id2, Edge& attr)
 	{
-		eNode *e = new eNode;
-
-		if (e == NULL)
-			error("Out of memory");
-
-		e->from = id1;
-		e->to = id2;
-		e->attr = attr;
-		e->pos = -1;
-		nNode *pn = nodes;
-		if (lastNode != NULL && lastNode->id <= id1)
-		{
-			pn = lastNode;
-		}
-		while (pn != NULL && pn->id < id1)
-		{
-			pn = pn->next;
-		}
-		if (pn == NULL || pn->id != id1)
+		if (id1 >= count)
 			error("Bad param 1 in ARGEdit::InsertEdge: %d", (int)id1);
-
-		eNode *p = pn->edges, *p0 = NULL;
-		if (lastEdge != NULL && lastEdge->from == id1 && lastEdge->to < id2)
-		{
-			p0 = lastEdge;
-			p = lastEdge->next;
-		}
-		while (p != NULL && p->to < id2)
-		{
-			p0 = p;
-			p = p->next;
-		}
-
-		if (p != NULL && p->to == id2)
+		if (id2 >= count)
 			error("Bad param 2 in ARGEdit::InsertEdge: %d", (int)id2);
 
-		if (p0 == NULL)
-		{
-			e->next = pn->edges;
-			pn->edges = e;
-		}
-		else
-		{
-			e->next = p0->next;
-			p0->next = e;
-		}
+		eNode e;
+		e.from = id1;
+		e.to = id2;
+		e.attr = attr;
 
-		pn->count++;
-		lastNode = pn;
-		lastEdge = e;
+		edges.push_back(e);
+		indexed = false;
 	}
 
 
@@ -385,80 +275,33 @@ namespace vflib
 	template<typename Node, typename Edge>
 	void ARGEdit<Node, Edge>::DeleteNode(nodeID_t id)
 	{
-		nNode *p = nodes, *p0 = NULL;
-
-		if (lastNode != NULL && lastNode->id < id)
-		{
-			p0 = lastNode;
-			p = lastNode->next;
-		}
-		while (p != NULL && p->id < id)
-		{
-			p0 = p;
-			p = p->next;
-		}
-
-		if (p == NULL || !(p->id == id))
+		if (id >= count)
 			error("Bad param in ARGEdit::DeleteNode");
 
-		while (p->edges != NULL)
+		AttrVector<Node> kept;
+		kept.reserve(count - 1);
+		for (nodeID_t n = 0; n < count; n++)
 		{
-			eNode *ep = p->edges;
-			p->edges = ep->next;
-			delete ep;
+			if (n != id)
+				kept.push_back(attrs[n]);
 		}
-		lastEdge = NULL;
-		delete p->attr;
-		if (p0 == NULL)
-		{
-			nodes = p->next;
-		}
-		else
-		{
-			p0->next = p->next;
-		}
-		delete p;
+		attrs = kept;
 		count--;
 
-		p = nodes;
-		while (p != NULL)
+		size_t k = 0;
+		for (size_t e = 0; e < edges.size(); e++)
 		{
-			if (p->id > id)
-				p->id--;
-			eNode *ep0 = NULL;
-			eNode *ep = p->edges;
-			while (ep != NULL)
-			{
-				if (ep->to == id)
-				{
-					if (ep0 == NULL)
-					{
-						p->edges = ep->next;
-					}
-					else
-					{
-						ep0->next = ep->next;
-					}
-
-					delete ep;
-					p->count--;
-					if (ep0 == NULL)
-						ep = p->edges;
-					else
-						ep = ep0->next;
-					continue;
-				}
-				if (ep->from > id)
-					ep->from--;
-				if (ep->to > id)
-					ep->to--;
-				ep0 = ep;
-				ep = ep->next;
-			}
-			p = p->next;
+			eNode edge = edges[e];
+			if (edge.from == id || edge.to == id)
+				continue;
+			if (edge.from > id)
+				edge.from--;
+			if (edge.to > id)
+				edge.to--;
+			edges[k++] = edge;
 		}
-
-		lastNode = p0;
+		edges.resize(k);
+		indexed = false;
 	}
 
 	/**
@@ -469,49 +312,21 @@ namespace vflib
 	template<typename Node, typename Edge>
 	void ARGEdit<Node, Edge>::DeleteEdge(nodeID_t id1, nodeID_t id2)
 	{
-		nNode *pn = nodes;
-
-		if (lastNode != NULL && lastNode->id <= id1)
-			pn = lastNode;
-
-		while (pn != NULL && pn->id < id1)
-			pn = pn->next;
-
-		if (pn == NULL || pn->id != id1)
+		if (id1 >= count)
 			error("Bad param in ARGEdit::DeleteEdge");
-
-		eNode *pe = pn->edges, *pe0 = NULL;
-
-		if (lastEdge != NULL &&  lastEdge->from == id1 && lastEdge->to < id2)
-		{
-			pe0 = lastEdge;
-			pe = pe0->next;
-		}
-
-		while (pe != NULL && pe->to < id2)
-		{
-			pe0 = pe;
-			pe = pe->next;
-		}
-
-		if (pe == NULL || pe->to != id2)
-		{
+		Index();
+
+		eNode key;
+		key.from = id1;
+		key.to = id2;
+		typename std::vector<eNode>::iterator it = std::lower_bound(edges.begin() + offset[id1],
+			edges.begin() + offset[id1 + 1], key);
+		if (it == edges.begin() + offset[id1 + 1] || it->to != id2)
 			error("Bad param in ARGEdit::DeleteEdge");
-		}
-
-		if (pe0 == NULL)
-		{
-			pn->edges = pe->next;
-		}
-		else
-		{
-			pe0->next = pe->next;
-		}
-		delete pe;
-		pn->count--;
 
-		lastNode = pn;
-		lastEdge = pe0;
+		edges.erase(it);
+		for (nodeID_t n = id1 + 1; n <= count; n++)
+			offset[n]--;
 	}
 
 }
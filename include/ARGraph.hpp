@@ -13,7 +13,10 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <limits>
+#include <memory>
 #include <vector>
+#include <thread>
+#include <algorithm>
 
 #include <Error.hpp>
 
@@ -39,9 +42,10 @@ namespace vflib
 				return true;
 			}
 
+			//All the Empty attributes are equivalent, so none precedes another
 			friend inline bool operator< (const Empty & s1, const Empty & s2)
 			{
-				return  true;
+				return  false;
 			}
 
 	};
@@ -60,6 +64,138 @@ namespace vflib
 		}
 	};
 
+	/**
+	* @brief Tells at compile time whether the comparison of two attributes always succeeds,
+	* that is when both are Empty and compared by the default functor. The matching states
+	* use it to skip copying and comparing the attributes.
+	*/
+	template<typename T1, typename T2, typename Comparator>
+	struct TrivialComparison
+	{
+		static const bool value = false;
+	};
+
+	template<>
+	struct TrivialComparison<Empty, Empty, EqualityComparator<Empty, Empty> >
+	{
+		static const bool value = true;
+	};
+
+	/**
+	* @class ArrayStore
+	* @brief Array of the graph representation, either owning its elements or viewing
+	* elements stored elsewhere, e.g. in a mapped graph file (see GraphFile.hpp).
+	* @details The elements are always reached through a plain pointer, so that a view
+	* costs the same as an owned array. Modifying the size of a view turns it into an
+	* owned copy; the viewed memory must outlive the view. The copies of an array always
+	* own their elements, so that a copy of a graph (e.g. a NUMA replica of the target)
+	* has its own memory even if the graph views a mapped file.
+	*/
+	template<typename T>
+	class ArrayStore
+	{
+	private:
+		std::vector<T> owned;
+		T *elements;
+		size_t count;
+		bool viewing;
+
+		inline void Own()
+		{
+			if (viewing)
+			{
+				owned.assign(elements, elements + count);
+				viewing = false;
+			}
+		}
+
+		inline void Sync()
+		{
+			elements = owned.data();
+			count = owned.size();
+		}
+
+	public:
+		typedef T* iterator;
+		typedef const T* const_iterator;
+
+		ArrayStore(): elements(NULL), count(0), viewing(false) {}
+
+		ArrayStore(const ArrayStore &a):
+			owned(a.begin(), a.end()), viewing(false)
+		{
+			Sync();
+		}
+
+		ArrayStore& operator=(const ArrayStore &a)
+		{
+			if (this != &a)
+			{
+				owned.assign(a.begin(), a.end());
+				viewing = false;
+				Sync();
+			}
+			return *this;
+		}
+
+		/**
+		* @brief Makes the array a view of count elements starting at p.
+		*/
+		void View(T *p, size_t n)
+		{
+			std::vector<T>().swap(owned);
+			elements = p;
+			count = n;
+			viewing = true;
+		}
+
+		inline bool IsView() const { return viewing; }
+
+		void resize(size_t n) { Own(); owned.resize(n); Sync(); }
+		void reserve(size_t n) { Own(); owned.reserve(n); Sync(); }
+		void push_back(const T &x) { Own(); owned.push_back(x); Sync(); }
+		void assign(size_t n, const T &x) { viewing = false; owned.assign(n, x); Sync(); }
+		void clear() { viewing = false; owned.clear(); Sync(); }
+
+		inline size_t size() const { return count; }
+		inline bool empty() const { return !count; }
+		inline T* data() { return elements; }
+		inline const T* data() const { return elements; }
+		inline T& operator[](size_t i) { return elements[i]; }
+		inline const T& operator[](size_t i) const { return elements[i]; }
+		inline iterator begin() { return elements; }
+		inline iterator end() { return elements + count; }
+		inline const_iterator begin() const { return elements; }
+		inline const_iterator end() const { return elements + count; }
+	};
+
+	/**
+	* @class AttrVector
+	* @brief Attributes of the nodes or of the edges of a graph, one for each of them.
+	* @details The specialization for Empty attributes stores nothing: every element is the
+	* same static Empty, so the graphs without attributes spend no memory on them.
+	*/
+	template<typename T>
+	class AttrVector : public ArrayStore<T>
+	{
+	};
+
+	template<>
+	class AttrVector<Empty>
+	{
+	public:
+		inline void resize(size_t) {}
+		inline void reserve(size_t) {}
+		inline void push_back(const Empty&) {}
+		inline void View(Empty*, size_t) {}
+		inline size_t size() const { return 0; }
+		inline Empty& operator[](size_t) const
+		{
+			static Empty empty;
+			return empty;
+		}
+	};
+
 	/**
 	* @class ARGLoader
 	* @brief Abstract class ARGLoader. Allows to construct an ARGraph.
@@ -103,6 +239,12 @@ namespace vflib
 		virtual nodeID_t GetOutEdge(nodeID_t node, uint32_t i, Edge *pattr) = 0;
 	};
 
+	template <typename Node, typename Edge>
+	class GraphFile;
+
+	template <typename Node, typename Edge>
+	class DirectGraphLoader;
+
 	/**
 	* @class ARGraph
 	* @brief This is the real representation of an ARG.
@@ -112,21 +254,30 @@ namespace vflib
 	* suited for efficient graph matching, which is the primary target
 	* of this program.
 	*
-	* Edges and edge attributes (pointers) are stored into sorted
-	* vectors associated to each node, and are looked for
-	* using binary search.
+	* Edges and edge attributes are stored in compressed sparse row
+	* (CSR) form: for each direction, a single array holds the
+	* neighbors of all the nodes, sorted by node, and an array of
+	* offsets gives the range of each node. The edge attributes are
+	* stored in arrays parallel to the neighbor ones.
+	* The arrays may also view a mapped graph file, see GraphFile.hpp.
+	*
+	* By default the existence of an edge is checked by a binary search
+	* of the neighbors of its start node. Optional structures, built on
+	* demand, make the checks and the enumeration of the candidates faster:
+	* - an adjacency index (BuildAdjacencyIndex), with a bitset for each
+	*   node of high out degree and a Bloom filter for the others;
+	* - an adjacency bit matrix (BuildAdjacencyMatrix), for the small
+	*   dense graphs, answering HasEdge with a single memory access;
+	* - a class index (BuildClassIndex), grouping the neighbors of each
+	*   node by node class.
 	*
-	* Nodes are identified using the type node_id, which is currently
-	* unsigned short; the special value NULL_NODE is used as null
+	* Nodes are identified using the type nodeID_t, which is currently
+	* uint32_t; the special value NULL_NODE is used as null
 	* value for this type.
 	*
 	* Bound checks are performed using the assert macro. They can be
 	* disabled by ensuring the macro NDEBUG is defined during
 	* compilation.
-	*
-	* Differently from the previous versions  of this library
-	* (before version 2.0), there is no more an adjacency matrix to
-	* check for the existence of a node.
 	* @see argloader.hpp
 	* @see argedit.hpp
 	*/
@@ -141,9 +292,15 @@ namespace vflib
 			param_type param);					/**<Type for the visitor of edges in the graph */
 
 	private:
+		friend class GraphFile<Node, Edge>;
+		friend class DirectGraphLoader<Node, Edge>;
+
 		typedef std::vector<nodeID_t> NodeVec;
-		typedef std::vector<Edge> EdgeAttrVector;
-		typedef std::vector<Node> NodeAttrVector;
+		typedef std::vector<uint32_t> OffsetVec;
+		typedef ArrayStore<nodeID_t> NodeArray;
+		typedef ArrayStore<uint32_t> OffsetArray;
+		typedef AttrVector<Edge> EdgeAttrVector;
+		typedef AttrVector<Node> NodeAttrVector;
 
 		uint32_t n;                               /**<number of nodes  */
 		uint32_t n_attr_count;					  /**<number of different node attributes */
@@ -156,15 +313,75 @@ namespace vflib
 		uint32_t max_deg_out;                     /**<max out degree over all the nodes */
 		uint32_t max_degree;                      /**<max degree over all the nodes */
 		NodeAttrVector attr;                 /**<node attributes  */
-		std::vector<EdgeAttrVector> in_attr;      /**<Edge attributes for 'in' edges */
-		std::vector<EdgeAttrVector> out_attr;     /**<Edge attributes for 'out' edges */
-		std::vector<NodeVec> in;                  /**<nodes connected by 'in' edges to each n*/
-		std::vector<NodeVec> out;                 /**<nodes connected by 'out' edges to each node */
+		OffsetArray in_offset;                    /**<Start of the 'in' edges of each node, n+1 entries */
+		OffsetArray out_offset;                   /**<Start of the 'out' edges of each node, n+1 entries */
+		NodeArray in;                             /**<nodes connected by 'in' edges, grouped by node */
+		NodeArray out;                            /**<nodes connected by 'out' edges, grouped by node */
+		EdgeAttrVector in_attr;                   /**<Edge attributes for 'in' edges, parallel to in */
+		EdgeAttrVector out_attr;                  /**<Edge attributes for 'out' edges, parallel to out */
+		std::shared_ptr<void> backing;            /**<Mapped file viewed by the arrays, if any */
+
+		/* Optional adjacency index of the 'out' edges, see BuildAdjacencyIndex */
+		std::vector<uint32_t> hub_slot;           /**<Bitset of each hub in hub_bits, NULL_NODE for the other nodes */
+		std::vector<uint64_t> hub_bits;           /**<Adjacency bitsets of the hubs, n bits each */
+		std::vector<uint64_t> bloom;              /**<Bloom filter word of the neighbors of each node */
+		uint32_t hub_words;                       /**<Words of each bitset */
+
+		/* Optional adjacency bit matrix of the 'out' edges, see BuildAdjacencyMatrix */
+		std::vector<uint64_t> matrix;             /**<Row of each node, n bits each */
+		uint32_t matrix_words;                    /**<Words of each row */
+
+		/* Optional partition of the neighbors by node class, see BuildClassIndex */
+		struct ClassRun
+		{
+			uint32_t cls;                         /**<Class of the neighbors in the run */
+			uint32_t begin;                       /**<Start of the run in out_by_class or in_by_class */
+			uint32_t end;                         /**<End of the run */
+		};
+		typedef std::vector<ClassRun> ClassRunVec;
+		NodeVec out_by_class;                     /**<'out' neighbors of each node grouped by class, sorted by node within a class */
+		NodeVec in_by_class;                      /**<'in' neighbors of each node grouped by class, sorted by node within a class */
+		ClassRunVec out_runs;                     /**<Runs of out_by_class of each node, sorted by class */
+		ClassRunVec in_runs;                      /**<Runs of in_by_class of each node, sorted by class */
+		OffsetVec out_run_offset;                 /**<Start of the runs of each node in out_runs, n+1 entries */
+		OffsetVec in_run_offset;                  /**<Start of the runs of each node in in_runs, n+1 entries */
+		bool runs_by_degree;                      /**<Runs sorted by decreasing degree instead of by node */
+
+		static const uint32_t MIN_EDGES_PER_THREAD = 1 << 16; /**<smallest share of edges worth a thread while building */
 
 		bool GetNodeIndex(nodeID_t n1, nodeID_t n2, nodeID_t &index) const;
+		void BuildInEdges(unsigned int threads);
+		void PartitionByClass(const OffsetArray &offset, const NodeArray &nodes, const uint32_t *classes,
+			NodeVec &by_class, ClassRunVec &runs, OffsetVec &run_offset);
+		static inline const nodeID_t* FindClassRun(const NodeVec &by_class, const ClassRunVec &runs,
+			uint32_t first, uint32_t last, uint32_t cls, uint32_t &count);
+
+		static inline uint64_t BloomMask(nodeID_t node)
+		{
+			uint64_t h = (uint64_t)node * 0x9E3779B97F4A7C15ULL;
+			return (1ULL << (h >> 58)) | (1ULL << ((h >> 52) & 63));
+		}
+		inline bool MayHaveEdge(nodeID_t n1, nodeID_t n2) const;
+
+		ARGraph();
 
 	public:
-		ARGraph(ARGLoader<Node, Edge> *loader);
+		ARGraph(ARGLoader<Node, Edge> *loader, unsigned int threads = 0);
+
+		void BuildAdjacencyIndex(uint32_t hub_degree = 0);
+		inline bool HasAdjacencyIndex() const { return !bloom.empty(); }
+
+		static const size_t DEFAULT_MATRIX_BUDGET = (size_t)256 << 20; /**<default memory for the bit matrix */
+		static const uint32_t DEFAULT_MATRIX_RATIO = 4;                /**<default bound of the matrix size over the CSR size */
+		bool BuildAdjacencyMatrix(size_t budget = DEFAULT_MATRIX_BUDGET, uint32_t max_ratio = DEFAULT_MATRIX_RATIO);
+		inline bool HasAdjacencyMatrix() const { return !matrix.empty(); }
+
+		void BuildClassIndex(const uint32_t *classes, bool by_degree = false);
+		inline bool HasClassIndex() const { return !out_run_offset.empty(); }
+		inline bool ClassIndexByDegree() const { return runs_by_degree; }
+		inline uint32_t DegreeCutoff(const nodeID_t *set, uint32_t count, uint32_t min_degree) const;
+		inline const nodeID_t* GetOutEdgeSetOfClass(nodeID_t node, uint32_t cls, uint32_t &count) const;
+		inline const nodeID_t* GetInEdgeSetOfClass(nodeID_t node, uint32_t cls, uint32_t &count) const;
 
 		uint32_t NodeCount() const;
 		uint32_t EdgeCount() const;
@@ -284,10 +501,36 @@ namespace vflib
 	template <typename Node, typename Edge>
 	inline bool ARGraph<Node, Edge>::HasEdge(nodeID_t n1, nodeID_t n2) const
 	{
+		assert(n1 < n);
+		assert(n2 < n);
+
+		//The bit matrix or the bitset of a hub answer by themselves
+		if (matrix.size())
+			return (matrix[(size_t)n1 * matrix_words + (n2 >> 6)] >> (n2 & 63)) & 1;
+		if (hub_slot.size() && hub_slot[n1] != NULL_NODE)
+			return (hub_bits[(size_t)hub_slot[n1] * hub_words + (n2 >> 6)] >> (n2 & 63)) & 1;
+
 		nodeID_t index;
 		return GetNodeIndex(n1, n2, index);
 	}
 
+	/**
+	* @brief Quick check of the adjacency index.
+	* @retval FALSE If the edge surely doesn't exist.
+	* @retval TRUE If the edge may exist, or there is no index.
+	*/
+	template <typename Node, typename Edge>
+	inline bool ARGraph<Node, Edge>::MayHaveEdge(nodeID_t n1, nodeID_t n2) const
+	{
+		if (matrix.size())
+			return (matrix[(size_t)n1 * matrix_words + (n2 >> 6)] >> (n2 & 63)) & 1;
+		if (bloom.empty())
+			return true;
+		if (hub_slot[n1] != NULL_NODE)
+			return (hub_bits[(size_t)hub_slot[n1] * hub_words + (n2 >> 6)] >> (n2 & 63)) & 1;
+		return (bloom[n1] & BloomMask(n2)) == BloomMask(n2);
+	}
+
 	/**
 	* @brief Gets the index of node n2 in the neighboors set of n1.
 	* @param [in] n1 First node id.
@@ -300,19 +543,23 @@ namespace vflib
 	inline bool ARGraph<Node, Edge>::GetNodeIndex(nodeID_t n1, nodeID_t n2, nodeID_t &index) const
 	{
 		unsigned long a, b, c;
-		//NodeVec id = out[n1];
+		const nodeID_t *adj;
 
 		assert(n1 < n);
 		assert(n2 < n);
 
+		if (!MayHaveEdge(n1, n2))
+			return false;
+
+		adj = &out[out_offset[n1]];
 		a = 0;
-		b = out[n1].size();
+		b = out_offset[n1 + 1] - out_offset[n1];
 		while (a < b)
 		{
 			c = (unsigned)(a + b) >> 1;
-			if (out[n1][c] < n2)
+			if (adj[c] < n2)
 				a = c + 1;
-			else if (out[n1][c] > n2)
+			else if (adj[c] > n2)
 				b = c;
 			else
 			{
@@ -335,8 +582,10 @@ namespace vflib
 	inline Edge& ARGraph<Node, Edge>::GetEdgeAttr(nodeID_t n1, nodeID_t n2)
 	{
 		nodeID_t index;
-		assert(GetNodeIndex(n1, n2, index) == true);
-		return out_attr[n1][index];
+		bool found = GetNodeIndex(n1, n2, index);
+		assert(found == true);
+		(void)found;
+		return out_attr[out_offset[n1] + index];
 	}
 
 	/**
@@ -348,7 +597,7 @@ namespace vflib
 	inline uint32_t ARGraph<Node, Edge>::InEdgeCount(nodeID_t node) const
 	{
 		assert(node < n);
-		return (int)in[node].size();
+		return in_offset[node + 1] - in_offset[node];
 	}
 
 
@@ -361,7 +610,7 @@ namespace vflib
 	inline uint32_t ARGraph<Node, Edge>::OutEdgeCount(nodeID_t node) const
 	{
 		assert(node < n);
-		return (int)out[node].size();
+		return out_offset[node + 1] - out_offset[node];
 	}
 
 	/**
@@ -373,7 +622,7 @@ namespace vflib
 	inline uint32_t ARGraph<Node, Edge>::EdgeCount(nodeID_t node) const
 	{
 		assert(node < n);
-		return in[node].size() + out[node].size();
+		return InEdgeCount(node) + OutEdgeCount(node);
 	}
 
 	/**
@@ -386,10 +635,8 @@ namespace vflib
 	inline nodeID_t ARGraph<Node, Edge>::GetInEdge(nodeID_t node, uint32_t i) const
 	{
 		assert(node < n);
-		assert(i < in[node].size());
-		if (node == 2 && i == 0)
-			return in[node][i];
-		return in[node][i];
+		assert(i < InEdgeCount(node));
+		return in[in_offset[node] + i];
 	}
 
 	/**
@@ -404,9 +651,9 @@ namespace vflib
 		Edge& pattr) const
 	{
 		assert(node < n);
-		assert(i < in[node].size());
-		pattr = in_attr[node][i];
-		return in[node][i];
+		assert(i < InEdgeCount(node));
+		pattr = in_attr[in_offset[node] + i];
+		return in[in_offset[node] + i];
 	}
 
 	/**
@@ -419,8 +666,8 @@ namespace vflib
 	inline nodeID_t ARGraph<Node, Edge>::GetOutEdge(nodeID_t node, uint32_t i) const
 	{
 		assert(node < n);
-		assert(i < out[node].size());
-		return out[node][i];
+		assert(i < OutEdgeCount(node));
+		return out[out_offset[node] + i];
 	}
 
 	/**
@@ -435,9 +682,9 @@ namespace vflib
 		Edge& pattr) const
 	{
 		assert(node < n);
-		assert(i < out[node].size());
-		pattr = out_attr[node][i];
-		return out[node][i];
+		assert(i < OutEdgeCount(node));
+		pattr = out_attr[out_offset[node] + i];
+		return out[out_offset[node] + i];
 	}
 
 	/**
@@ -460,7 +707,7 @@ namespace vflib
 	template <typename Node, typename Edge>
 	inline nodeID_t* ARGraph<Node, Edge>::GetOutEdgeSet(nodeID_t node)
 	{
-		return out[node].data();
+		return out.data() + out_offset[node];
 	}
 
 	/**
@@ -471,7 +718,7 @@ namespace vflib
 	template <typename Node, typename Edge>
 	inline nodeID_t* ARGraph<Node, Edge>::GetInEdgeSet(nodeID_t node)
 	{
-		return in[node].data();
+		return in.data() + in_offset[node];
 	}
 
 	/*-------------------------------------------------------------------
@@ -498,7 +745,7 @@ namespace vflib
 	{
 		nodeID_t index;
 		if (GetNodeIndex(n1, n2, index)) {
-			pattr = out_attr[n1][index];
+			pattr = out_attr[out_offset[n1] + index];
 			return true;
 		}
 		return false;
@@ -519,10 +766,17 @@ namespace vflib
 		assert(n2 < n);
 
 		if (GetNodeIndex(n1, n2, c))
-			out_attr[n1][c] = new_attr;
+			out_attr[out_offset[n1] + c] = new_attr;
 
-		if (GetNodeIndex(n2, n1, c))
-			in_attr[n2][c] = new_attr;
+		//The 'in' edges of n2 are sorted by source node
+		for (c = in_offset[n2]; c < in_offset[n2 + 1]; c++)
+		{
+			if (in[c] == n1)
+			{
+				in_attr[c] = new_attr;
+				break;
+			}
+		}
 	}
 
 	/**
@@ -537,8 +791,8 @@ namespace vflib
 	{
 		assert(node < n);
 		size_t i;
-		for (i = 0; i < in[node].size(); i++)
-			vis(this, in[node][i], node, in_attr[node][i], param);
+		for (i = in_offset[node]; i < in_offset[node + 1]; i++)
+			vis(this, in[i], node, &in_attr[i], param);
 	}
 
 	/**
@@ -553,8 +807,8 @@ namespace vflib
 	{
 		assert(node < n);
 		size_t i;
-		for (i = 0; i < out[node].size(); i++)
-			vis(this, node, out[node][i], out_attr[node][i], param);
+		for (i = out_offset[node]; i < out_offset[node + 1]; i++)
+			vis(this, node, out[i], &out_attr[i], param);
 	}
 
 	/**
@@ -570,14 +824,334 @@ namespace vflib
 		VisitOutEdges(node, vis, param);
 	}
 
+	/**
+	* @brief Builds the n x n bit matrix of the 'out' edges, if it fits the memory budget
+	* and the graph is dense enough.
+	* @details With the matrix HasEdge is a single memory access. It suits the small dense
+	* graphs, e.g. 64K nodes take 512MB. For a sparse graph the matrix would be much larger
+	* than the CSR arrays for little gain over the binary search, so it is built only when
+	* its size is at most max_ratio times the size of the 'in' and 'out' CSR arrays.
+	* @param budget Memory available for the matrix, in bytes.
+	* @param max_ratio Bound of the size of the matrix over the size of the CSR arrays, 0 for none.
+	* @retval TRUE If the matrix has been built.
+	*/
+	template <typename Node, typename Edge>
+	bool ARGraph<Node, Edge>::BuildAdjacencyMatrix(size_t budget, uint32_t max_ratio)
+	{
+		uint32_t row_words = (n + 63) / 64;
+		size_t words = (size_t)n * row_words;
+		if (!n || words > budget / sizeof(uint64_t))
+			return false;
+		uint64_t csr_size = ((uint64_t)n + 1) * 2 * sizeof(uint32_t) + (uint64_t)e_out_count * 2 * sizeof(nodeID_t);
+		if (max_ratio && words * sizeof(uint64_t) > max_ratio * csr_size)
+			return false;
+
+		matrix_words = row_words;
+		matrix.assign(words, 0);
+		for (nodeID_t i = 0; i < n; i++)
+		{
+			uint64_t *row = &matrix[(size_t)i * matrix_words];
+			for (uint32_t e = out_offset[i]; e < out_offset[i + 1]; e++)
+				row[out[e] >> 6] |= 1ULL << (out[e] & 63);
+		}
+		return true;
+	}
+
+	/**
+	* @brief Builds copies of the 'in' and 'out' neighbor lists grouped by node class.
+	* @details The candidates for a pattern node of class c are the neighbors of class c
+	* of a matched node, thus with the index they are enumerated without visiting the
+	* neighbors of the other classes. Within a class the neighbors keep their order,
+	* so each slice is sorted by node as the whole lists.
+	* Optionally the slices are sorted by decreasing degree (EdgeCount), so that the
+	* neighbors with enough edges to host a pattern node are a prefix of the slice,
+	* see DegreeCutoff.
+	* The index takes the memory of the neighbor lists plus 12 bytes for each run of
+	* neighbors of the same class. Building it again replaces the previous one.
+	* @param classes Class of each node.
+	* @param by_degree Sorts the slices by decreasing degree, ties by node.
+	*/
+	template <typename Node, typename Edge>
+	void ARGraph<Node, Edge>::BuildClassIndex(const uint32_t *classes, bool by_degree)
+	{
+		runs_by_degree = by_degree;
+		PartitionByClass(out_offset, out, classes, out_by_class, out_runs, out_run_offset);
+		PartitionByClass(in_offset, in, classes, in_by_class, in_runs, in_run_offset);
+	}
+
+	template <typename Node, typename Edge>
+	void ARGraph<Node, Edge>::PartitionByClass(const OffsetArray &offset, const NodeArray &nodes,
+		const uint32_t *classes, NodeVec &by_class, ClassRunVec &runs, OffsetVec &run_offset)
+	{
+		by_class.assign(nodes.begin(), nodes.end());
+		runs.clear();
+		run_offset.resize(n + 1);
+		for (nodeID_t i = 0; i < n; i++)
+		{
+			run_offset[i] = runs.size();
+			NodeVec::iterator first = by_class.begin() + offset[i];
+			NodeVec::iterator last = by_class.begin() + offset[i + 1];
+			std::stable_sort(first, last, [this, classes](nodeID_t a, nodeID_t b) {
+				if (classes[a] != classes[b])
+					return classes[a] < classes[b];
+				return runs_by_degree && EdgeCount(a) > EdgeCount(b);
+			});
+
+			for (uint32_t e = offset[i]; e < offset[i + 1]; e++)
+			{
+				uint32_t cls = classes[by_class[e]];
+				if (runs.size() > run_offset[i] && runs.back().cls == cls)
+				{
+					runs.back().end = e + 1;
+				}
+				else
+				{
+					ClassRun run = { cls, e, e + 1 };
+					runs.push_back(run);
+				}
+			}
+		}
+		run_offset[n] = runs.size();
+	}
+
+	template <typename Node, typename Edge>
+	inline const nodeID_t* ARGraph<Node, Edge>::FindClassRun(const NodeVec &by_class, const ClassRunVec &runs,
+		uint32_t first, uint32_t last, uint32_t cls, uint32_t &count)
+	{
+		uint32_t low = first, high = last;
+		while (low < high)
+		{
+			uint32_t mid = (low + high) / 2;
+			if (runs[mid].cls < cls)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+		if (low == last || runs[low].cls != cls)
+		{
+			count = 0;
+			return NULL;
+		}
+		count = runs[low].end - runs[low].begin;
+		return by_class.data() + runs[low].begin;
+	}
+
+	/**
+	* @brief Length of the prefix of a slice of the class index whose nodes have at least min_degree edges.
+	* @note The class index must have been built sorting the slices by degree.
+	* @param [in] set Slice returned by GetOutEdgeSetOfClass or GetInEdgeSetOfClass.
+	*/
+	template <typename Node, typename Edge>
+	inline uint32_t ARGraph<Node, Edge>::DegreeCutoff(const nodeID_t *set, uint32_t count, uint32_t min_degree) const
+	{
+		assert(runs_by_degree);
+		uint32_t low = 0, high = count;
+		while (low < high)
+		{
+			uint32_t mid = (low + high) / 2;
+			if (EdgeCount(set[mid]) >= min_degree)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+		return low;
+	}
+
+	/**
+	* @brief Gets the 'out' neighbors of a node having a given class.
+	* @note The class index must have been built.
+	* @param [out] count Number of neighbors of the class.
+	* @returns Neighbors of the class, sorted by node.
+	*/
+	template <typename Node, typename Edge>
+	inline const nodeID_t* ARGraph<Node, Edge>::GetOutEdgeSetOfClass(nodeID_t node, uint32_t cls, uint32_t &count) const
+	{
+		assert(node < n);
+		assert(HasClassIndex());
+		return FindClassRun(out_by_class, out_runs, out_run_offset[node], out_run_offset[node + 1], cls, count);
+	}
+
+	/**
+	* @brief Gets the 'in' neighbors of a node having a given class.
+	* @note The class index must have been built.
+	* @param [out] count Number of neighbors of the class.
+	* @returns Neighbors of the class, sorted by node.
+	*/
+	template <typename Node, typename Edge>
+	inline const nodeID_t* ARGraph<Node, Edge>::GetInEdgeSetOfClass(nodeID_t node, uint32_t cls, uint32_t &count) const
+	{
+		assert(node < n);
+		assert(HasClassIndex());
+		return FindClassRun(in_by_class, in_runs, in_run_offset[node], in_run_offset[node + 1], cls, count);
+	}
+
+	/**
+	* @brief Builds an index of the 'out' edges making HasEdge faster.
+	* @details The index has a representation for each node, chosen by its out degree:
+	* - the hubs have a bitset of n bits, thus HasEdge on them is a single memory access;
+	* - the other nodes have a 64 bits Bloom filter of their neighbors, that rejects
+	*   most of the missing edges without the binary search.
+	* By default a node is a hub when its bitset is not larger than twice its
+	* neighbor list, that is when its out degree is at least n/64, thus the memory of
+	* the index is at most 8 bytes per node plus twice the memory of the 'out' edges.
+	* @param hub_degree Smallest out degree of a hub, 0 for the default.
+	*/
+	template <typename Node, typename Edge>
+	void ARGraph<Node, Edge>::BuildAdjacencyIndex(uint32_t hub_degree)
+	{
+		if (!hub_degree)
+			hub_degree = n / 64 > 64 ? n / 64 : 64;
+
+		hub_words = (n + 63) / 64;
+		hub_slot.assign(n, NULL_NODE);
+		hub_bits.clear();
+		bloom.assign(n, 0);
+
+		uint32_t hubs = 0;
+		for (nodeID_t i = 0; i < n; i++)
+		{
+			if (OutEdgeCount(i) >= hub_degree)
+				hub_slot[i] = hubs++;
+		}
+		hub_bits.assign((size_t)hubs * hub_words, 0);
+
+		for (nodeID_t i = 0; i < n; i++)
+		{
+			uint64_t *bits = hub_slot[i] != NULL_NODE ? &hub_bits[(size_t)hub_slot[i] * hub_words] : NULL;
+			for (uint32_t e = out_offset[i]; e < out_offset[i + 1]; e++)
+			{
+				bloom[i] |= BloomMask(out[e]);
+				if (bits)
+					bits[out[e] >> 6] |= 1ULL << (out[e] & 63);
+			}
+		}
+	}
+
+	/**
+	* @brief Builds the 'in' edges transposing the 'out' ones with a counting sort.
+	* @details The sources are split in ranges with about the same number of edges,
+	* one for each thread. Each thread counts the edges of its range entering each node,
+	* then the counts are turned into the positions where each range writes its edges.
+	* Since the ranges are ordered and each range is visited in order, the 'in' edges
+	* of each node come out sorted by source node.
+	* The cost is O(E + n * threads).
+	* @param threads Number of threads, 0 for the number of cpus.
+	*/
+	template <typename Node, typename Edge>
+	void ARGraph<Node, Edge>::BuildInEdges(unsigned int threads)
+	{
+		if (!threads)
+			threads = std::thread::hardware_concurrency();
+		if (threads > e_out_count / MIN_EDGES_PER_THREAD)
+			threads = e_out_count / MIN_EDGES_PER_THREAD;
+		if (threads < 1)
+			threads = 1;
+
+		in.resize(e_in_count);
+		in_attr.resize(e_in_count);
+
+		//Sources of each thread, balancing the edges
+		std::vector<nodeID_t> first_source(threads + 1, n);
+		first_source[0] = 0;
+		nodeID_t node = 0;
+		for (unsigned int k = 1; k < threads; k++)
+		{
+			uint64_t edges = (uint64_t)e_out_count * k / threads;
+			while (node < n && out_offset[node] < edges)
+				node++;
+			first_source[k] = node;
+		}
+
+		std::vector<OffsetVec> position(threads);
+		std::vector<std::thread> pool;
+
+		//Runs the body on each range, in the calling thread when there is only one
+		auto run = [&](void (*body)(ARGraph*, std::vector<OffsetVec>&, const std::vector<nodeID_t>&, unsigned int))
+		{
+			if (threads == 1)
+			{
+				body(this, position, first_source, 0);
+				return;
+			}
+			for (unsigned int k = 0; k < threads; k++)
+				pool.push_back(std::thread(body, this, std::ref(position), std::cref(first_source), k));
+			for (size_t k = 0; k < pool.size(); k++)
+				pool[k].join();
+			pool.clear();
+		};
+
+		//Counting the edges of each range entering each node
+		run([](ARGraph* g, std::vector<OffsetVec>& position, const std::vector<nodeID_t>& first_source, unsigned int k)
+		{
+			OffsetVec& count = position[k];
+			count.assign(g->n, 0);
+			for (uint32_t e = g->out_offset[first_source[k]]; e < g->out_offset[first_source[k + 1]]; e++)
+				count[g->out[e]]++;
+		});
+
+		//Turning the counts into the first position of each range in each 'in' list
+		run([](ARGraph* g, std::vector<OffsetVec>& position, const std::vector<nodeID_t>& /*first_source*/, unsigned int k)
+		{
+			uint32_t threads = position.size();
+			for (nodeID_t t = (uint64_t)g->n * k / threads; t < (uint64_t)g->n * (k + 1) / threads; t++)
+			{
+				uint32_t next = g->in_offset[t];
+				for (uint32_t r = 0; r < threads; r++)
+				{
+					uint32_t count = position[r][t];
+					position[r][t] = next;
+					next += count;
+				}
+			}
+		});
+
+		//Scattering the edges
+		run([](ARGraph* g, std::vector<OffsetVec>& position, const std::vector<nodeID_t>& first_source, unsigned int k)
+		{
+			OffsetVec& next = position[k];
+			for (nodeID_t source = first_source[k]; source < first_source[k + 1]; source++)
+			{
+				for (uint32_t e = g->out_offset[source]; e < g->out_offset[source + 1]; e++)
+				{
+					uint32_t p = next[g->out[e]]++;
+					g->in[p] = source;
+					g->in_attr[p] = g->out_attr[e];
+				}
+			}
+		});
+	}
+
+	/**
+	* @brief Constructs an empty graph, filled by GraphFile.
+	*/
+	template <typename Node, typename Edge>
+	ARGraph<Node, Edge>::ARGraph()
+	{
+		n = 0;
+		hub_words = 0;
+		matrix_words = 0;
+		runs_by_degree = false;
+		e_count = 0;
+		e_out_count = 0;
+		e_in_count = 0;
+		n_attr_count = 0;
+		e_attr_count = 0;
+		node_label_count = 0;
+		max_deg_in = max_deg_out = max_degree = 0;
+	}
+
 	/**
 	* @brief Constructs the graph form a loader.
 	* @param loader ARGLoader
+	* @param threads Threads used to build the 'in' edges, 0 for the number of cpus.
 	*/
 	template <typename Node, typename Edge>
-	ARGraph<Node, Edge>::ARGraph(ARGLoader<Node, Edge> *loader)
+	ARGraph<Node, Edge>::ARGraph(ARGLoader<Node, Edge> *loader, unsigned int threads)
 	{
 		n = loader->NodeCount();
+		hub_words = 0;
+		matrix_words = 0;
+		runs_by_degree = false;
 		e_count = 0;
 		e_out_count = 0;
 		e_in_count = 0;
@@ -590,6 +1164,7 @@ namespace vflib
 		max_deg_in = max_deg_out = max_degree = 0;
 
 		uint32_t i, j;
+		attr.reserve(n);
 		for (i = 0; i < n; i++)
 		{
 			Node attribute = loader->GetNodeAttr(i);
@@ -602,59 +1177,52 @@ namespace vflib
 			}
 		}
 
+		out_offset.resize(n + 1);
+		out_offset[0] = 0;
 		for (i = 0; i < n; i++)
 		{
 			uint32_t k = loader->OutEdgeCount(i);
-			e_out_count += k;
+			out_offset[i + 1] = out_offset[i] + k;
 
 			if (k > max_deg_out)
 				max_deg_out = k;
+		}
+		e_out_count = out_offset[n];
 
-			NodeVec nv_out;
-			EdgeAttrVector eav_out(k);
-			out.push_back(nv_out);
-			out_attr.push_back(eav_out);
-
+		out.resize(e_out_count);
+		out_attr.resize(e_out_count);
+		for (i = 0; i < n; i++)
+		{
+			uint32_t k = out_offset[i + 1] - out_offset[i];
 			for (j = 0; j < k; j++)
 			{
-				nodeID_t n2 = loader->GetOutEdge(i, j, &out_attr[i][j]);
-				out[i].push_back(n2);
+				nodeID_t n2 = loader->GetOutEdge(i, j, &out_attr[out_offset[i] + j]);
+				out[out_offset[i] + j] = n2;
 				in_node_count[n2]++;
 			}
 		}
 
+		in_offset.resize(n + 1);
+		in_offset[0] = 0;
 		for (i = 0; i < n; i++)
 		{
 			uint32_t k = in_node_count[i];
-			e_in_count += k;
+			in_offset[i + 1] = in_offset[i] + k;
 
 			if (k > max_deg_in)
 				max_deg_in = k;
+		}
+		e_in_count = in_offset[n];
 
-			NodeVec nv;
-			EdgeAttrVector eav;
-			in.push_back(nv);
-			in_attr.push_back(eav);
+		BuildInEdges(threads);
 
-			uint32_t l = 0;
-			for (j = 0; j < n; j++)
-			{
-				if (HasEdge(j, i))
-				{
-					Edge edge_attr = GetEdgeAttr(j, i);
-					in[i].push_back(j);
-					in_attr[i].push_back(edge_attr);
-					l++;
-
-					if(!e_attributemap.count(edge_attr))
-					{ 
-						e_attributemap[edge_attr]=true;
-						e_attr_count++;
-					}
-				}
+		for (i = 0; i < e_in_count; i++)
+		{
+			if(!e_attributemap.count(in_attr[i]))
+			{ 
+				e_attributemap[in_attr[i]]=true;
+				e_attr_count++;
 			}
-
-			assert(l == k);
 		}
 
 		for (i = 0; i < n; i++) {
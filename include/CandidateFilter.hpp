@@ -0,0 +1,184 @@
+/**
+ * @file   CandidateFilter.hpp
+ * @brief  Kernels looking for the next candidate of NextPair.
+ * @details A target node is a candidate for the pattern node of the current
+ * depth when it is not matched yet (core_2 is NULL_NODE) and it has the class
+ * of the pattern node. The kernels test 8 (AVX2) or 16 (AVX-512) nodes at time,
+ * gathering their core and class entries, and return the first survivor of the
+ * resulting mask, so that the scan has a branch every 8 or 16 nodes instead of
+ * two for each node.
+ * The vector kernel is chosen once, at runtime, from the cpu features; the scalar
+ * one is used on the other architectures and compilers.
+ * Node ids are handled as signed 32 bits indices by the gathers, thus the vector
+ * kernels assume graphs with less than 2^31 nodes.
+ */
+
+#ifndef CANDIDATEFILTER_HPP
+#define CANDIDATEFILTER_HPP
+
+#include <stdint.h>
+
+#include "ARGraph.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define VF_CANDIDATE_FILTER_SIMD
+#include <immintrin.h>
+#endif
+
+namespace vflib
+{
+
+	/**
+	* @brief Kernel returning the index of the first candidate among nodes[i], start <= i < count,
+	* or count if there is none. When nodes is NULL, node i is i itself.
+	*/
+	typedef uint32_t(*CandidateScan)(const nodeID_t *nodes, uint32_t start, uint32_t count,
+		const nodeID_t *core_2, const uint32_t *class_2, uint32_t c);
+
+	inline uint32_t ScanCandidatesScalar(const nodeID_t *nodes, uint32_t start, uint32_t count,
+		const nodeID_t *core_2, const uint32_t *class_2, uint32_t c)
+	{
+		uint32_t i;
+		if (nodes)
+		{
+			for (i = start; i < count; i++)
+			{
+				nodeID_t node = nodes[i];
+				if (core_2[node] == NULL_NODE && class_2[node] == c)
+					break;
+			}
+		}
+		else
+		{
+			for (i = start; i < count; i++)
+			{
+				if (core_2[i] == NULL_NODE && class_2[i] == c)
+					break;
+			}
+		}
+		return i;
+	}
+
+#ifdef VF_CANDIDATE_FILTER_SIMD
+	__attribute__((target("avx2")))
+	inline uint32_t ScanCandidatesAVX2(const nodeID_t *nodes, uint32_t start, uint32_t count,
+		const nodeID_t *core_2, const uint32_t *class_2, uint32_t c)
+	{
+		const __m256i free_node = _mm256_set1_epi32((int)NULL_NODE);
+		const __m256i node_class = _mm256_set1_epi32((int)c);
+
+		uint32_t i = start;
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256i core, cls;
+			if (nodes)
+			{
+				__m256i index = _mm256_loadu_si256((const __m256i*)(nodes + i));
+				core = _mm256_i32gather_epi32((const int*)core_2, index, 4);
+				cls = _mm256_i32gather_epi32((const int*)class_2, index, 4);
+			}
+			else
+			{
+				core = _mm256_loadu_si256((const __m256i*)(core_2 + i));
+				cls = _mm256_loadu_si256((const __m256i*)(class_2 + i));
+			}
+
+			__m256i hit = _mm256_and_si256(_mm256_cmpeq_epi32(core, free_node),
+				_mm256_cmpeq_epi32(cls, node_class));
+			int mask = _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+			if (mask)
+				return i + __builtin_ctz(mask);
+		}
+		return ScanCandidatesScalar(nodes, i, count, core_2, class_2, c);
+	}
+
+	__attribute__((target("avx512f")))
+	inline uint32_t ScanCandidatesAVX512(const nodeID_t *nodes, uint32_t start, uint32_t count,
+		const nodeID_t *core_2, const uint32_t *class_2, uint32_t c)
+	{
+		const __m512i free_node = _mm512_set1_epi32((int)NULL_NODE);
+		const __m512i node_class = _mm512_set1_epi32((int)c);
+
+		uint32_t i = start;
+		for (; i + 16 <= count; i += 16)
+		{
+			__m512i core, cls;
+			if (nodes)
+			{
+				__m512i index = _mm512_loadu_si512((const void*)(nodes + i));
+				//The masked form with a defined source, the plain one leaves it undefined
+				core = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), (__mmask16)0xFFFF, index,
+					(const void*)core_2, 4);
+				cls = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), (__mmask16)0xFFFF, index,
+					(const void*)class_2, 4);
+			}
+			else
+			{
+				core = _mm512_loadu_si512((const void*)(core_2 + i));
+				cls = _mm512_loadu_si512((const void*)(class_2 + i));
+			}
+
+			__mmask16 mask = _mm512_cmpeq_epi32_mask(core, free_node) &
+				_mm512_cmpeq_epi32_mask(cls, node_class);
+			if (mask)
+				return i + __builtin_ctz(mask);
+		}
+		return ScanCandidatesScalar(nodes, i, count, core_2, class_2, c);
+	}
+#endif
+
+	/**
+	* @brief Chooses the widest kernel supported by the cpu.
+	*/
+	inline CandidateScan SelectCandidateScan()
+	{
+#ifdef VF_CANDIDATE_FILTER_SIMD
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f"))
+			return ScanCandidatesAVX512;
+		if (__builtin_cpu_supports("avx2"))
+			return ScanCandidatesAVX2;
+#endif
+		return ScanCandidatesScalar;
+	}
+
+	/*
+	* Holder of the kernel chosen at startup.
+	* Being a template, its static member can be defined in the header.
+	*/
+	template <int Unused = 0>
+	struct CandidateFilterDispatch
+	{
+		static const CandidateScan scan;
+	};
+
+	template <int Unused>
+	const CandidateScan CandidateFilterDispatch<Unused>::scan = SelectCandidateScan();
+
+	/**
+	* @brief Index of the first candidate among nodes[start, count).
+	* @param [in] nodes Nodes to scan, e.g. the neighbors of a node.
+	* @param [in] core_2 Core set of the target graph.
+	* @param [in] class_2 Classes of the target nodes.
+	* @param [in] c Class of the pattern node.
+	* @returns Index of the candidate, count if there is none.
+	*/
+	inline uint32_t NextCandidate(const nodeID_t *nodes, uint32_t start, uint32_t count,
+		const nodeID_t *core_2, const uint32_t *class_2, uint32_t c)
+	{
+		return CandidateFilterDispatch<>::scan(nodes, start, count, core_2, class_2, c);
+	}
+
+	/**
+	* @brief First candidate among the target nodes from start to count-1.
+	* @returns Candidate node, count if there is none.
+	*/
+	inline uint32_t NextFreeCandidate(uint32_t start, uint32_t count,
+		const nodeID_t *core_2, const uint32_t *class_2, uint32_t c)
+	{
+		return CandidateFilterDispatch<>::scan(NULL, start, count, core_2, class_2, c);
+	}
+
+}
+
+#endif /* CANDIDATEFILTER_HPP */
@@ -0,0 +1,319 @@
+/**
+ * @file   DirectGraphLoader.hpp
+ * @brief  Loader building an ARGraph from a .grf file without intermediate copies.
+ * @details Loading through an ARGLoader keeps the whole graph twice, in the loader and
+ * in the ARGraph, plus the text when it is read at once. This loader reads the file
+ * twice through a buffer of fixed size, writing straight into the arrays of the graph:
+ *  - the first pass reads the node attributes and counts the 'out' and 'in' edges
+ *    of each node, giving the offsets of the CSR arrays;
+ *  - the second pass reads again the edges, storing each one at its place.
+ * The 'in' edges are then built from the 'out' ones with at most as many threads as fit
+ * in a fifth of the size of the graph, so that the peak memory stays close to the size
+ * of the graph. The file must be seekable.
+ * The format is the one described in StreamARGLoader, parsed as in FastARGLoader.
+ */
+
+#ifndef DIRECTGRAPHLOADER_HPP
+#define DIRECTGRAPHLOADER_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+#ifndef WIN32
+#include <sys/types.h>
+#endif
+
+#include "ARGraph.hpp"
+#include "FastARGLoader.hpp"
+
+namespace vflib
+{
+
+	/*
+	* Reads the non blank, non comment lines of a file through a buffer.
+	* The lines returned end with '\n' and stay valid until the next call.
+	* Comment lines start with one of the given chars.
+	*/
+	class TextLineReader
+	{
+	private:
+		static const size_t BLOCK_SIZE = 1 << 20;
+
+		FILE *f;
+		const char *path;
+		const char *comments;
+		std::vector<char> buffer;
+		size_t begin;                 /**<Start of the unread data in the buffer */
+		size_t end;                   /**<End of the data in the buffer */
+		uint64_t base;                /**<Position in the file of the start of the buffer */
+		bool eof;
+
+	public:
+		TextLineReader(const char *path, const char *comments = "#"):
+			path(path), comments(comments), buffer(BLOCK_SIZE + 1), begin(0), end(0), base(0), eof(false)
+		{
+			f = fopen(path, "rb");
+			if (!f)
+				error("Unable to open %s", path);
+		}
+
+		~TextLineReader()
+		{
+			fclose(f);
+		}
+
+		/**
+		* @brief Position in the file of the next line.
+		*/
+		uint64_t Tell() const
+		{
+			return base + begin;
+		}
+
+		void Seek(uint64_t position)
+		{
+#ifndef WIN32
+			if (fseeko(f, (off_t)position, SEEK_SET))
+#else
+			if (_fseeki64(f, (__int64)position, SEEK_SET))
+#endif
+				error("Unable to read %s", path);
+			base = position;
+			begin = end = 0;
+			eof = false;
+		}
+
+		/**
+		* @brief Next line, or NULL at the end of the file.
+		*/
+		const char* Next()
+		{
+			while (true)
+			{
+				char *data = buffer.data();
+				const char *nl = (const char*)memchr(data + begin, '\n', end - begin);
+				if (!nl && eof && begin < end)
+				{
+					//Last line without newline, the buffer has room for one more char
+					data[end] = '\n';
+					nl = data + end++;
+				}
+				if (nl)
+				{
+					const char *line = TextScanner::SkipBlanks(data + begin);
+					begin = nl - data + 1;
+					if (*line != '\n' && !strchr(comments, *line))
+						return line;
+					continue;
+				}
+				if (eof)
+					return NULL;
+
+				//Moving the partial line at the start of the buffer, growing it for long lines
+				memmove(data, data + begin, end - begin);
+				base += begin;
+				end -= begin;
+				begin = 0;
+				if (end + BLOCK_SIZE / 2 > buffer.size() - 1)
+					buffer.resize(2 * buffer.size());
+				data = buffer.data();
+				size_t read = fread(data + end, 1, buffer.size() - 1 - end, f);
+				if (!read)
+					eof = true;
+				end += read;
+			}
+		}
+	};
+
+	/**
+	* @class DirectGraphLoader
+	* @brief Builds an ARGraph from a .grf file with a memory peak close to the size of the graph.
+	*/
+	template <typename Node, typename Edge>
+	class DirectGraphLoader
+	{
+	private:
+		typedef ARGraph<Node, Edge> Graph;
+
+		static const char* NextLine(TextLineReader &reader)
+		{
+			const char *line = reader.Next();
+			if (!line)
+				error("End of file or reading error");
+			return line;
+		}
+
+		static void FormatError(const char *line)
+		{
+			const char *end = line;
+			while (!TextScanner::IsEnd(*end))
+				end++;
+			error("File format error\n  Line: %.*s", (int)(end - line), line);
+		}
+
+		/*
+		* Reads the edge sections, calling visit(id1, id2, attribute text) for each edge
+		*/
+		template <typename Visitor>
+		static void ReadEdges(TextLineReader &reader, uint32_t n, Visitor visit)
+		{
+			for (nodeID_t i = 0; i < n; i++)
+			{
+				const char *line = NextLine(reader);
+				int64_t count;
+				bool ok = true;
+				TextScanner::ParseInt(line, count, ok);
+				if (!ok)
+					FormatError(line);
+
+				for (int64_t j = 0; j < count; j++)
+				{
+					line = NextLine(reader);
+					int64_t id1, id2;
+					const char *p = TextScanner::ParseInt(line, id1, ok);
+					p = TextScanner::ParseInt(p, id2, ok);
+					if (!ok || id1 < 0 || id1 >= n || id2 < 0 || id2 >= n)
+						FormatError(line);
+					visit((nodeID_t)id1, (nodeID_t)id2, p);
+				}
+			}
+		}
+
+		/*
+		* Sorts the 'out' edges of each node by end node, rejecting duplicates
+		*/
+		static void SortOutEdges(Graph *g)
+		{
+			std::vector<std::pair<nodeID_t, Edge> > edges;
+			for (nodeID_t i = 0; i < g->n; i++)
+			{
+				uint32_t first = g->out_offset[i], last = g->out_offset[i + 1];
+				if (!std::is_sorted(g->out.begin() + first, g->out.begin() + last))
+				{
+					edges.clear();
+					for (uint32_t e = first; e < last; e++)
+						edges.push_back(std::make_pair(g->out[e], (Edge)g->out_attr[e]));
+					std::stable_sort(edges.begin(), edges.end(),
+						[](const std::pair<nodeID_t, Edge> &a, const std::pair<nodeID_t, Edge> &b) {
+							return a.first < b.first;
+						});
+					for (uint32_t e = first; e < last; e++)
+					{
+						g->out[e] = edges[e - first].first;
+						g->out_attr[e] = edges[e - first].second;
+					}
+				}
+				for (uint32_t e = first + 1; e < last; e++)
+				{
+					if (g->out[e] == g->out[e - 1])
+						error("Duplicate edge %d -> %d", (int)i, (int)g->out[e]);
+				}
+			}
+		}
+
+	public:
+		/**
+		* @brief Loads a graph.
+		* @param path Path of the file.
+		* @param threads Maximum number of threads building the 'in' edges, 0 for the number of cpus.
+		* @returns The graph, owned by the caller.
+		*/
+		static Graph* Load(const char *path, unsigned int threads = 0)
+		{
+			TextLineReader reader(path);
+			const char *line = NextLine(reader);
+			int64_t count;
+			bool ok = true;
+			TextScanner::ParseInt(line, count, ok);
+			if (!ok || count >= NULL_NODE)
+				FormatError(line);
+			uint32_t n = count > 0 ? count : 0;
+
+			Graph *g = new Graph();
+			g->n = n;
+
+			std::map<Node, bool> attributes;
+			g->attr.reserve(n);
+			for (nodeID_t i = 0; i < n; i++)
+			{
+				line = NextLine(reader);
+				int64_t id;
+				const char *p = TextScanner::ParseInt(line, id, ok);
+				if (!ok || id != i)
+					FormatError(line);
+				Node a = Node();
+				TextField<Node>::Parse(p, a);
+				g->attr.push_back(a);
+				if (!attributes.count(a))
+				{
+					attributes[a] = true;
+					g->n_attr_count++;
+				}
+			}
+			uint64_t edges_start = reader.Tell();
+
+			//First pass: degrees
+			g->out_offset.assign(n + 1, 0);
+			g->in_offset.assign(n + 1, 0);
+			ReadEdges(reader, n, [g](nodeID_t id1, nodeID_t id2, const char*) {
+				g->out_offset[id1 + 1]++;
+				g->in_offset[id2 + 1]++;
+			});
+			for (nodeID_t i = 0; i < n; i++)
+			{
+				uint32_t out_degree = g->out_offset[i + 1], in_degree = g->in_offset[i + 1];
+				g->max_deg_out = std::max(g->max_deg_out, out_degree);
+				g->max_deg_in = std::max(g->max_deg_in, in_degree);
+				g->max_degree = std::max(g->max_degree, out_degree + in_degree);
+				g->out_offset[i + 1] += g->out_offset[i];
+				g->in_offset[i + 1] += g->in_offset[i];
+			}
+			uint32_t m = n ? g->out_offset[n] : 0;
+			g->e_out_count = g->e_in_count = m;
+			g->e_count = 2 * m;
+
+			//Second pass: 'out' edges
+			g->out.resize(m);
+			g->out_attr.resize(m);
+			{
+				std::vector<uint32_t> next(g->out_offset.begin(), g->out_offset.end());
+				reader.Seek(edges_start);
+				ReadEdges(reader, n, [g, &next](nodeID_t id1, nodeID_t id2, const char *p) {
+					uint32_t e = next[id1]++;
+					g->out[e] = id2;
+					TextField<Edge>::Parse(p, g->out_attr[e]);
+				});
+			}
+			SortOutEdges(g);
+
+			std::map<Edge, bool> e_attributes;
+			for (uint32_t e = 0; e < m; e++)
+			{
+				if (!e_attributes.count(g->out_attr[e]))
+				{
+					e_attributes[g->out_attr[e]] = true;
+					g->e_attr_count++;
+				}
+			}
+
+			//Each thread building the 'in' edges needs a counter for each node
+			uint64_t graph_size = (uint64_t)(n + 1) * 2 * sizeof(uint32_t) + (uint64_t)m * 2 * sizeof(nodeID_t);
+			uint64_t budget = graph_size / 5 / ((uint64_t)(n + 1) * sizeof(uint32_t));
+			if (!threads)
+				threads = std::thread::hardware_concurrency();
+			if (threads > budget)
+				threads = budget;
+			if (threads < 1)
+				threads = 1;
+			g->BuildInEdges(threads);
+			return g;
+		}
+	};
+
+}
+
+#endif /* DIRECTGRAPHLOADER_HPP */
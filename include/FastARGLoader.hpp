@@ -0,0 +1,461 @@
+/**
+ * @file   FastARGLoader.hpp
+ * @brief  Multi-threaded loader of the text format of StreamARGLoader.
+ * @details StreamARGLoader reads a line at time through a stream and inserts the edges
+ * in the linked lists of ARGEdit. This loader reads the whole file with a single read,
+ * then:
+ *  - indexes the lines, each thread scanning a block of the file;
+ *  - follows the edge counts of the nodes, the only sequential step, to find the
+ *    lines of the edges of each node;
+ *  - parses the node and edge lines with a hand-written scanner, each thread
+ *    taking a range of nodes with about the same number of edges;
+ *  - stores the edges directly in CSR form, sorted by end node.
+ * The format is the one described in StreamARGLoader. Integer attributes are parsed by
+ * the scanner; the other attributes are read with their stream operator from a single
+ * token (no token at all for Empty).
+ */
+
+#ifndef FASTARGLOADER_HPP
+#define FASTARGLOADER_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ARGraph.hpp"
+
+namespace vflib
+{
+
+	/*
+	* Scanner of the fields of a line. Fields are separated by blanks, lines end with '\n'.
+	*/
+	struct TextScanner
+	{
+		static inline const char* SkipBlanks(const char *p)
+		{
+			while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\v' || *p == '\f')
+				p++;
+			return p;
+		}
+
+		static inline bool IsEnd(char c)
+		{
+			return c == '\n' || c == '\0';
+		}
+
+		/*
+		* Parses a decimal integer, setting ok to false if there are no digits
+		*/
+		static inline const char* ParseInt(const char *p, int64_t &v, bool &ok)
+		{
+			p = SkipBlanks(p);
+			bool negative = *p == '-';
+			if (*p == '-' || *p == '+')
+				p++;
+			if (*p < '0' || *p > '9')
+			{
+				ok = false;
+				v = 0;
+				return p;
+			}
+			uint64_t x = 0;
+			while (*p >= '0' && *p <= '9')
+				x = x * 10 + (*p++ - '0');
+			v = negative ? -(int64_t)x : (int64_t)x;
+			return p;
+		}
+	};
+
+	/*
+	* Parser of an attribute read with its stream operator from a token
+	*/
+	template <typename T, bool Scanned = std::is_integral<T>::value && (sizeof(T) > 1)>
+	struct TextField
+	{
+		static const char* Parse(const char *p, T &v)
+		{
+			p = TextScanner::SkipBlanks(p);
+			const char *end = p;
+			while (!TextScanner::IsEnd(*end) && *end != ' ' && *end != '\t' && *end != '\r')
+				end++;
+			std::istringstream is(std::string(p, end));
+			is >> v;
+			return end;
+		}
+	};
+
+	template <typename T>
+	struct TextField<T, true>
+	{
+		static const char* Parse(const char *p, T &v)
+		{
+			int64_t x;
+			bool ok = true;
+			p = TextScanner::ParseInt(p, x, ok);
+			v = (T)x;
+			return p;
+		}
+	};
+
+	template <>
+	struct TextField<Empty, false>
+	{
+		static const char* Parse(const char *p, Empty &)
+		{
+			return p;
+		}
+	};
+
+	/**
+	* @class FastARGLoader
+	* @brief ARGLoader reading the text format of StreamARGLoader with several threads.
+	* @details The file is kept in memory only while loading; the loader then holds the
+	* node attributes and the edges in CSR form.
+	*/
+	template <typename Node, typename Edge>
+	class FastARGLoader : public ARGLoader<Node, Edge>
+	{
+	private:
+		static const size_t MIN_BYTES_PER_THREAD = 1 << 20;	/**<smallest block of the file worth a thread */
+
+		AttrVector<Node> attr;                  /**<Node attributes */
+		std::vector<uint32_t> offset;           /**<Start of the edges of each node, n+1 entries */
+		std::vector<nodeID_t> edges;            /**<End nodes of the edges, grouped by start node */
+		AttrVector<Edge> edge_attr;             /**<Edge attributes, parallel to edges */
+
+		std::vector<char> text;                 /**<Content of the file while loading */
+		std::vector<size_t> lines;              /**<Start of the non blank, non comment lines */
+		unsigned int threads;
+
+		/*
+		* Runs body(k) for k in [0, threads), in the calling thread when there is only one
+		*/
+		template <typename Body>
+		void Run(Body body)
+		{
+			if (threads == 1)
+			{
+				body(0);
+				return;
+			}
+			std::vector<std::thread> pool;
+			for (unsigned int k = 0; k < threads; k++)
+				pool.push_back(std::thread(body, k));
+			for (size_t k = 0; k < pool.size(); k++)
+				pool[k].join();
+		}
+
+		const char* Line(size_t i) const
+		{
+			if (i >= lines.size())
+				error("End of file or reading error");
+			return text.data() + lines[i];
+		}
+
+		void FormatError(const char *line) const
+		{
+			const char *end = line;
+			while (!TextScanner::IsEnd(*end))
+				end++;
+			error("File format error\n  Line: %.*s", (int)(end - line), line);
+		}
+
+		void ReadFile(const char *path);
+		void IndexLines();
+		void ParseNodes();
+		void ParseEdges();
+		void SortEdges(uint32_t first, uint32_t last);
+
+	public:
+		FastARGLoader(const char *path, unsigned int threads = 0);
+
+		virtual uint32_t NodeCount() const
+		{
+			return offset.size() - 1;
+		}
+
+		virtual Node GetNodeAttr(nodeID_t node)
+		{
+			return attr[node];
+		}
+
+		virtual uint32_t OutEdgeCount(nodeID_t node) const
+		{
+			return offset[node + 1] - offset[node];
+		}
+
+		virtual nodeID_t GetOutEdge(nodeID_t node, uint32_t i, Edge *pattr)
+		{
+			if (pattr)
+				*pattr = edge_attr[offset[node] + i];
+			return edges[offset[node] + i];
+		}
+	};
+
+	/**
+	* @brief Loads a graph file.
+	* @param path Path of the file.
+	* @param threads Number of threads, 0 for the number of cpus.
+	*/
+	template <typename Node, typename Edge>
+	FastARGLoader<Node, Edge>::FastARGLoader(const char *path, unsigned int threads)
+	{
+		ReadFile(path);
+
+		if (!threads)
+			threads = std::thread::hardware_concurrency();
+		if (threads > text.size() / MIN_BYTES_PER_THREAD)
+			threads = text.size() / MIN_BYTES_PER_THREAD;
+		if (threads < 1)
+			threads = 1;
+		this->threads = threads;
+
+		IndexLines();
+		ParseNodes();
+		ParseEdges();
+
+		std::vector<char>().swap(text);
+		std::vector<size_t>().swap(lines);
+	}
+
+	template <typename Node, typename Edge>
+	void FastARGLoader<Node, Edge>::ReadFile(const char *path)
+	{
+		FILE *f = fopen(path, "rb");
+		if (!f)
+			error("Unable to open %s", path);
+		fseek(f, 0, SEEK_END);
+		long size = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		if (size < 0)
+			error("Unable to read %s", path);
+
+		//A final newline and a terminator, so that the scanner needs no bound checks
+		text.resize(size + 2);
+		if (fread(text.data(), 1, size, f) != (size_t)size)
+			error("Unable to read %s", path);
+		fclose(f);
+		text[size] = '\n';
+		text[size + 1] = '\0';
+	}
+
+	/*
+	* Each thread indexes the lines starting in its block of the file
+	*/
+	template <typename Node, typename Edge>
+	void FastARGLoader<Node, Edge>::IndexLines()
+	{
+		size_t size = text.size() - 1;
+		std::vector<std::vector<size_t> > found(threads);
+		Run([&](unsigned int k)
+		{
+			size_t begin = size * k / threads;
+			size_t end = size * (k + 1) / threads;
+			const char *base = text.data();
+			//Lines crossing the start of the block belong to the previous one
+			while (begin > 0 && begin < end && base[begin - 1] != '\n')
+				begin++;
+			std::vector<size_t> &out = found[k];
+			size_t p = begin;
+			while (p < end)
+			{
+				const char *s = TextScanner::SkipBlanks(base + p);
+				if (!TextScanner::IsEnd(*s) && *s != '#')
+					out.push_back(s - base);
+				const char *nl = (const char*)memchr(s, '\n', size - (s - base));
+				p = nl - base + 1;
+			}
+		});
+
+		size_t count = 0;
+		for (unsigned int k = 0; k < threads; k++)
+			count += found[k].size();
+		lines.reserve(count);
+		for (unsigned int k = 0; k < threads; k++)
+		{
+			lines.insert(lines.end(), found[k].begin(), found[k].end());
+			std::vector<size_t>().swap(found[k]);
+		}
+	}
+
+	template <typename Node, typename Edge>
+	void FastARGLoader<Node, Edge>::ParseNodes()
+	{
+		int64_t n;
+		bool ok = true;
+		TextScanner::ParseInt(Line(0), n, ok);
+		if (!ok)
+			FormatError(Line(0));
+		if (n < 0)
+			n = 0;
+		Line(n);
+
+		offset.assign(n + 1, 0);
+		attr.resize(n);
+		Run([&](unsigned int k)
+		{
+			for (nodeID_t i = n * k / threads; i < n * (k + 1) / threads; i++)
+			{
+				const char *line = Line(i + 1);
+				int64_t id;
+				bool ok = true;
+				const char *p = TextScanner::ParseInt(line, id, ok);
+				if (!ok || id != i)
+					FormatError(line);
+				Node a = Node();
+				TextField<Node>::Parse(p, a);
+				attr[i] = a;
+			}
+		});
+	}
+
+	template <typename Node, typename Edge>
+	void FastARGLoader<Node, Edge>::ParseEdges()
+	{
+		uint32_t n = NodeCount();
+
+		//Line of the edge count of each node, the edges follow it
+		std::vector<size_t> count_line(n);
+		size_t l = n + 1;
+		for (nodeID_t i = 0; i < n; i++)
+		{
+			int64_t count;
+			bool ok = true;
+			TextScanner::ParseInt(Line(l), count, ok);
+			if (!ok)
+				FormatError(Line(l));
+			if (count < 0)
+				count = 0;
+			count_line[i] = l;
+			offset[i + 1] = offset[i] + count;
+			l += count + 1;
+		}
+		if (n && offset[n])
+			Line(l - 1);
+
+		uint32_t m = offset[n];
+		edges.resize(m);
+		edge_attr.resize(m);
+
+		//Ranges of nodes with about the same number of edges
+		std::vector<nodeID_t> first_node(threads + 1, n);
+		first_node[0] = 0;
+		nodeID_t node = 0;
+		for (unsigned int k = 1; k < threads; k++)
+		{
+			uint64_t e = (uint64_t)m * k / threads;
+			while (node < n && offset[node] < e)
+				node++;
+			first_node[k] = node;
+		}
+
+		//Edges found in the section of another node, as (edge, start node)
+		std::vector<std::vector<std::pair<uint32_t, nodeID_t> > > moved(threads);
+		Run([&](unsigned int k)
+		{
+			for (nodeID_t i = first_node[k]; i < first_node[k + 1]; i++)
+			{
+				for (uint32_t e = offset[i]; e < offset[i + 1]; e++)
+				{
+					const char *line = Line(count_line[i] + 1 + e - offset[i]);
+					int64_t id1, id2;
+					bool ok = true;
+					const char *p = TextScanner::ParseInt(line, id1, ok);
+					p = TextScanner::ParseInt(p, id2, ok);
+					if (!ok || id1 < 0 || id1 >= n || id2 < 0 || id2 >= n)
+						FormatError(line);
+					edges[e] = id2;
+					TextField<Edge>::Parse(p, edge_attr[e]);
+					if (id1 != i)
+						moved[k].push_back(std::make_pair(e, (nodeID_t)id1));
+				}
+			}
+		});
+
+		bool regroup = false;
+		for (unsigned int k = 0; k < threads; k++)
+			regroup = regroup || !moved[k].empty();
+		if (regroup)
+		{
+			//The edges are regrouped by their start node, keeping the order of the file
+			std::vector<nodeID_t> source(m);
+			for (nodeID_t i = 0; i < n; i++)
+				std::fill(source.begin() + offset[i], source.begin() + offset[i + 1], i);
+			for (unsigned int k = 0; k < threads; k++)
+				for (size_t j = 0; j < moved[k].size(); j++)
+					source[moved[k][j].first] = moved[k][j].second;
+
+			std::vector<uint32_t> next(n + 1, 0);
+			for (uint32_t e = 0; e < m; e++)
+				next[source[e] + 1]++;
+			for (nodeID_t i = 0; i < n; i++)
+				next[i + 1] += next[i];
+			offset = next;
+
+			std::vector<nodeID_t> grouped(m);
+			AttrVector<Edge> grouped_attr;
+			grouped_attr.resize(m);
+			for (uint32_t e = 0; e < m; e++)
+			{
+				uint32_t p = next[source[e]]++;
+				grouped[p] = edges[e];
+				grouped_attr[p] = edge_attr[e];
+			}
+			edges.swap(grouped);
+			edge_attr = grouped_attr;
+		}
+
+		Run([&](unsigned int k)
+		{
+			for (nodeID_t i = (uint64_t)n * k / threads; i < (uint64_t)n * (k + 1) / threads; i++)
+				SortEdges(offset[i], offset[i + 1]);
+		});
+	}
+
+	/*
+	* Sorts the edges of a node by end node, as the ARGraph expects, rejecting duplicates
+	*/
+	template <typename Node, typename Edge>
+	void FastARGLoader<Node, Edge>::SortEdges(uint32_t first, uint32_t last)
+	{
+		if (!std::is_sorted(edges.begin() + first, edges.begin() + last))
+		{
+			std::vector<uint32_t> perm(last - first);
+			for (uint32_t j = 0; j < perm.size(); j++)
+				perm[j] = first + j;
+			std::stable_sort(perm.begin(), perm.end(), [this](uint32_t a, uint32_t b) {
+				return edges[a] < edges[b];
+			});
+
+			std::vector<nodeID_t> sorted(perm.size());
+			std::vector<Edge> sorted_attr(perm.size());
+			for (uint32_t j = 0; j < perm.size(); j++)
+			{
+				sorted[j] = edges[perm[j]];
+				sorted_attr[j] = edge_attr[perm[j]];
+			}
+			for (uint32_t j = 0; j < perm.size(); j++)
+			{
+				edges[first + j] = sorted[j];
+				edge_attr[first + j] = sorted_attr[j];
+			}
+		}
+
+		for (uint32_t e = first + 1; e < last; e++)
+		{
+			if (edges[e] == edges[e - 1])
+				error("Duplicate edge to node %d", (int)edges[e]);
+		}
+	}
+
+}
+
+#endif /* FASTARGLOADER_HPP */
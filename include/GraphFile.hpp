@@ -0,0 +1,285 @@
+/**
+ * @file   GraphFile.hpp
+ * @brief  Binary graph files, loaded by mapping them in memory.
+ * @details A graph file stores the CSR representation of an ARGraph as it is in memory:
+ * the offsets and the neighbors of the 'out' and of the 'in' edges, the node and edge
+ * attributes and the degree and attribute statistics, so that loading it costs a
+ * mapping of the file, with no parsing and no copy. The arrays of the graph view the
+ * mapped pages, which are read from the disk only when first used and are shared with
+ * the page cache; the mapping is private, so the graph can still be modified without
+ * touching the file.
+ * Layout of a file (numbers in the byte order of the machine writing it):
+ *  - header: GraphFileHeader;
+ *  - sections, each starting at a multiple of GRAPH_FILE_ALIGNMENT:
+ *    out offsets (n+1 uint32), out neighbors (m uint32), in offsets (n+1 uint32),
+ *    in neighbors (m uint32), node attributes (n), out edge attributes (m),
+ *    in edge attributes (m).
+ * The attribute sections are empty for Empty attributes. Other attributes are
+ * stored with their memory representation, thus they must be trivially copyable.
+ * The node classes are not stored, as they depend on the pattern they are computed with.
+ */
+
+#ifndef GRAPHFILE_HPP
+#define GRAPHFILE_HPP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#include <type_traits>
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "ARGraph.hpp"
+
+namespace vflib
+{
+
+	static const char GRAPH_FILE_MAGIC[8] = { 'V', 'F', '3', 'G', 'R', 'A', 'P', 'H' };
+	static const uint32_t GRAPH_FILE_VERSION = 1;
+	static const uint32_t GRAPH_FILE_BYTE_ORDER = 0x01020304;
+	static const uint64_t GRAPH_FILE_ALIGNMENT = 64;
+
+	enum GraphFileSection
+	{
+		SECTION_OUT_OFFSET,
+		SECTION_OUT,
+		SECTION_IN_OFFSET,
+		SECTION_IN,
+		SECTION_NODE_ATTR,
+		SECTION_OUT_ATTR,
+		SECTION_IN_ATTR,
+		SECTION_COUNT
+	};
+
+	struct GraphFileHeader
+	{
+		char magic[8];                      /**<GRAPH_FILE_MAGIC */
+		uint32_t version;                   /**<GRAPH_FILE_VERSION */
+		uint32_t byte_order;                /**<GRAPH_FILE_BYTE_ORDER as written by the producer */
+		uint32_t node_attr_size;            /**<Bytes of a node attribute, 0 for Empty */
+		uint32_t edge_attr_size;            /**<Bytes of an edge attribute, 0 for Empty */
+		uint32_t node_count;
+		uint32_t edge_count;                /**<Number of 'out' edges, equal to the 'in' ones */
+		uint32_t max_deg_in;
+		uint32_t max_deg_out;
+		uint32_t max_degree;
+		uint32_t node_attr_count;           /**<Number of different node attributes */
+		uint32_t edge_attr_count;           /**<Number of different edge attributes */
+		uint32_t reserved;
+		uint64_t section[SECTION_COUNT];    /**<Offset of each section from the start of the file */
+	};
+
+	/**
+	* @class GraphFile
+	* @brief Writes and loads the binary graph files.
+	*/
+	template <typename Node, typename Edge>
+	class GraphFile
+	{
+	private:
+		typedef ARGraph<Node, Edge> Graph;
+
+		static const uint32_t NODE_ATTR_SIZE = std::is_same<Node, Empty>::value ? 0 : sizeof(Node);
+		static const uint32_t EDGE_ATTR_SIZE = std::is_same<Edge, Empty>::value ? 0 : sizeof(Edge);
+
+		static void CheckAttributes()
+		{
+			if (!std::is_trivially_copyable<Node>::value || !std::is_trivially_copyable<Edge>::value)
+				error("Graph files can only store trivially copyable attributes");
+		}
+
+		static uint64_t Align(uint64_t offset)
+		{
+			return (offset + GRAPH_FILE_ALIGNMENT - 1) / GRAPH_FILE_ALIGNMENT * GRAPH_FILE_ALIGNMENT;
+		}
+
+		/*
+		* Bytes of each section for a graph with n nodes and m edges
+		*/
+		static void SectionSizes(uint64_t n, uint64_t m, uint64_t *size)
+		{
+			size[SECTION_OUT_OFFSET] = size[SECTION_IN_OFFSET] = (n + 1) * sizeof(uint32_t);
+			size[SECTION_OUT] = size[SECTION_IN] = m * sizeof(nodeID_t);
+			size[SECTION_NODE_ATTR] = n * NODE_ATTR_SIZE;
+			size[SECTION_OUT_ATTR] = size[SECTION_IN_ATTR] = m * EDGE_ATTR_SIZE;
+		}
+
+		/*
+		* Takes the address of a section, checking that it lies within the file
+		*/
+		template <typename T>
+		static T* Section(char *base, uint64_t file_size, const GraphFileHeader *h,
+			const uint64_t *size, GraphFileSection s, const char *path)
+		{
+			uint64_t offset = h->section[s];
+			if (offset % GRAPH_FILE_ALIGNMENT || offset > file_size || size[s] > file_size - offset)
+				error("Corrupted graph file %s", path);
+			return (T*)(base + offset);
+		}
+
+		/*
+		* Checks that the n+1 offsets of a CSR array go from 0 to m without decreasing
+		*/
+		static bool ValidOffsets(const uint32_t *offset, uint32_t n, uint32_t m)
+		{
+			if (offset[0] != 0 || offset[n] != m)
+				return false;
+			for (uint32_t i = 0; i < n; i++)
+			{
+				if (offset[i] > offset[i + 1])
+					return false;
+			}
+			return true;
+		}
+
+	public:
+		/**
+		* @brief Tells whether a file starts with the magic of the graph files.
+		*/
+		static bool IsGraphFile(const char *path)
+		{
+			char magic[sizeof(GRAPH_FILE_MAGIC)];
+			FILE *f = fopen(path, "rb");
+			if (!f)
+				return false;
+			bool found = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+				!memcmp(magic, GRAPH_FILE_MAGIC, sizeof(magic));
+			fclose(f);
+			return found;
+		}
+
+		/**
+		* @brief Writes a graph to a file.
+		*/
+		static void Write(const Graph &g, const char *path)
+		{
+			CheckAttributes();
+
+			GraphFileHeader h;
+			memset(&h, 0, sizeof(h));
+			memcpy(h.magic, GRAPH_FILE_MAGIC, sizeof(h.magic));
+			h.version = GRAPH_FILE_VERSION;
+			h.byte_order = GRAPH_FILE_BYTE_ORDER;
+			h.node_attr_size = NODE_ATTR_SIZE;
+			h.edge_attr_size = EDGE_ATTR_SIZE;
+			h.node_count = g.n;
+			h.edge_count = g.e_out_count;
+			h.max_deg_in = g.max_deg_in;
+			h.max_deg_out = g.max_deg_out;
+			h.max_degree = g.max_degree;
+			h.node_attr_count = g.n_attr_count;
+			h.edge_attr_count = g.e_attr_count;
+
+			uint64_t size[SECTION_COUNT];
+			SectionSizes(h.node_count, h.edge_count, size);
+			const void *data[SECTION_COUNT] = { g.out_offset.data(), g.out.data(),
+				g.in_offset.data(), g.in.data(), &g.attr[0], &g.out_attr[0], &g.in_attr[0] };
+
+			uint64_t offset = Align(sizeof(h));
+			for (int s = 0; s < SECTION_COUNT; s++)
+			{
+				h.section[s] = offset;
+				offset = Align(offset + size[s]);
+			}
+
+			FILE *f = fopen(path, "wb");
+			if (!f)
+				error("Unable to create the graph file %s", path);
+			static const char padding[GRAPH_FILE_ALIGNMENT] = { 0 };
+			bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+			uint64_t written = sizeof(h);
+			for (int s = 0; s < SECTION_COUNT && ok; s++)
+			{
+				ok = fwrite(padding, 1, h.section[s] - written, f) == h.section[s] - written &&
+					fwrite(data[s], 1, size[s], f) == size[s];
+				written = h.section[s] + size[s];
+			}
+			if (fclose(f) || !ok)
+				error("Unable to write the graph file %s", path);
+		}
+
+		/**
+		* @brief Loads a graph from a file, mapping it in memory.
+		* @details The offsets of the edges are checked, reading n words of each direction;
+		* the neighbors are not, so that the edge sections are read only when used.
+		* @returns The graph, owned by the caller. The mapping is released with the graph.
+		*/
+		static Graph* Load(const char *path)
+		{
+			CheckAttributes();
+
+			char *base;
+			uint64_t file_size;
+			std::shared_ptr<void> backing;
+#ifndef WIN32
+			int fd = open(path, O_RDONLY);
+			struct stat st;
+			if (fd < 0 || fstat(fd, &st))
+				error("Unable to open the graph file %s", path);
+			file_size = st.st_size;
+			if (file_size < sizeof(GraphFileHeader))
+				error("Corrupted graph file %s", path);
+			void *p = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			close(fd);
+			if (p == MAP_FAILED)
+				error("Unable to map the graph file %s", path);
+			backing = std::shared_ptr<void>(p, [file_size](void *q) { munmap(q, file_size); });
+#else
+			FILE *f = fopen(path, "rb");
+			if (!f)
+				error("Unable to open the graph file %s", path);
+			fseek(f, 0, SEEK_END);
+			file_size = ftell(f);
+			fseek(f, 0, SEEK_SET);
+			void *p = malloc(file_size ? file_size : 1);
+			if (!p || fread(p, 1, file_size, f) != file_size || file_size < sizeof(GraphFileHeader))
+				error("Unable to read the graph file %s", path);
+			fclose(f);
+			backing = std::shared_ptr<void>(p, free);
+#endif
+			base = (char*)p;
+
+			const GraphFileHeader *h = (const GraphFileHeader*)base;
+			if (memcmp(h->magic, GRAPH_FILE_MAGIC, sizeof(h->magic)))
+				error("%s is not a graph file", path);
+			if (h->version != GRAPH_FILE_VERSION || h->byte_order != GRAPH_FILE_BYTE_ORDER)
+				error("Unsupported version or byte order of the graph file %s", path);
+			if (h->node_attr_size != NODE_ATTR_SIZE || h->edge_attr_size != EDGE_ATTR_SIZE)
+				error("The attributes of the graph file %s do not match the graph type", path);
+
+			uint64_t size[SECTION_COUNT];
+			SectionSizes(h->node_count, h->edge_count, size);
+			uint32_t n = h->node_count, m = h->edge_count;
+
+			Graph *g = new Graph();
+			g->n = n;
+			g->e_out_count = g->e_in_count = m;
+			g->e_count = 2 * m;
+			g->max_deg_in = h->max_deg_in;
+			g->max_deg_out = h->max_deg_out;
+			g->max_degree = h->max_degree;
+			g->n_attr_count = h->node_attr_count;
+			g->e_attr_count = h->edge_attr_count;
+			g->out_offset.View(Section<uint32_t>(base, file_size, h, size, SECTION_OUT_OFFSET, path), n + 1);
+			g->out.View(Section<nodeID_t>(base, file_size, h, size, SECTION_OUT, path), m);
+			g->in_offset.View(Section<uint32_t>(base, file_size, h, size, SECTION_IN_OFFSET, path), n + 1);
+			g->in.View(Section<nodeID_t>(base, file_size, h, size, SECTION_IN, path), m);
+			g->attr.View(Section<Node>(base, file_size, h, size, SECTION_NODE_ATTR, path), n);
+			g->out_attr.View(Section<Edge>(base, file_size, h, size, SECTION_OUT_ATTR, path), m);
+			g->in_attr.View(Section<Edge>(base, file_size, h, size, SECTION_IN_ATTR, path), m);
+			if (!ValidOffsets(g->out_offset.data(), n, m) || !ValidOffsets(g->in_offset.data(), n, m))
+				error("Corrupted graph file %s", path);
+			g->backing = backing;
+			return g;
+		}
+	};
+
+}
+
+#endif /* GRAPHFILE_HPP */
@@ -0,0 +1,486 @@
+/**
+ * @file   GraphFormats.hpp
+ * @brief  Loaders of common graph interchange formats, and loading of a graph in any format.
+ * @details Besides the .grf text format (StreamARGLoader) and the binary graph files
+ * (GraphFile), graphs can be loaded from:
+ *  - edge lists: a line "u v [attribute]" for each edge, ids from 0, the number of nodes
+ *    being the largest id plus one; lines starting with # or % are comments;
+ *  - MatrixMarket coordinate files: entry (i, j) is the edge i-1 -> j-1, the value being
+ *    the attribute; symmetric, skew-symmetric and hermitian matrices give the edges in
+ *    both directions;
+ *  - LAD text files: the number of nodes, then a line for each node with the number of
+ *    its out edges followed by their end nodes;
+ *  - MIVIA binary files, as described in ARGLoader.hpp, with 16 or 32 bits little-endian
+ *    words; the 32 bits words allow more than 65535 nodes.
+ * The loaders read the files through a buffer of fixed size and store the edges in CSR
+ * form, sorted by end node; duplicate edges are kept once. The nodes get the default
+ * attribute, as do the edges in the formats without edge attributes.
+ */
+
+#ifndef GRAPHFORMATS_HPP
+#define GRAPHFORMATS_HPP
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ARGraph.hpp"
+#include "DirectGraphLoader.hpp"
+#include "FastARGLoader.hpp"
+#include "GraphFile.hpp"
+
+namespace vflib
+{
+
+	enum GraphFormat
+	{
+		FORMAT_AUTO,
+		FORMAT_GRF,
+		FORMAT_EDGE_LIST,
+		FORMAT_MATRIX_MARKET,
+		FORMAT_LAD,
+		FORMAT_MIVIA16,
+		FORMAT_MIVIA32
+	};
+
+	/**
+	* @brief Parses the name of a format: auto, grf, edgelist, mtx, lad, mivia16 or mivia32.
+	* @returns FALSE if the name is unknown.
+	*/
+	inline bool ParseGraphFormat(const std::string &name, GraphFormat &format)
+	{
+		if (name == "auto")
+			format = FORMAT_AUTO;
+		else if (name == "grf")
+			format = FORMAT_GRF;
+		else if (name == "edgelist")
+			format = FORMAT_EDGE_LIST;
+		else if (name == "mtx")
+			format = FORMAT_MATRIX_MARKET;
+		else if (name == "lad")
+			format = FORMAT_LAD;
+		else if (name == "mivia16")
+			format = FORMAT_MIVIA16;
+		else if (name == "mivia32")
+			format = FORMAT_MIVIA32;
+		else
+			return false;
+		return true;
+	}
+
+	/**
+	* @class CSRARGLoader
+	* @brief ARGLoader holding the graph in CSR form, base of the loaders of this file.
+	*/
+	template <typename Node, typename Edge>
+	class CSRARGLoader : public ARGLoader<Node, Edge>
+	{
+	protected:
+		AttrVector<Node> attr;                  /**<Node attributes */
+		std::vector<uint32_t> offset;           /**<Start of the edges of each node, n+1 entries */
+		std::vector<nodeID_t> edges;            /**<End nodes of the edges, grouped by start node */
+		AttrVector<Edge> edge_attr;             /**<Edge attributes, parallel to edges */
+
+		/*
+		* Groups by start node a list of edges in any order
+		*/
+		void Scatter(uint32_t n, const std::vector<nodeID_t> &source,
+			const std::vector<nodeID_t> &target, const AttrVector<Edge> &attrs)
+		{
+			size_t m = source.size();
+			offset.assign(n + 1, 0);
+			for (size_t e = 0; e < m; e++)
+				offset[source[e] + 1]++;
+			for (nodeID_t i = 0; i < n; i++)
+				offset[i + 1] += offset[i];
+
+			std::vector<uint32_t> next(offset.begin(), offset.end() - 1);
+			edges.resize(m);
+			edge_attr.resize(m);
+			for (size_t e = 0; e < m; e++)
+			{
+				uint32_t p = next[source[e]]++;
+				edges[p] = target[e];
+				edge_attr[p] = attrs[e];
+			}
+		}
+
+		/*
+		* Sorts the edges of each node by end node, keeping the first of the duplicates,
+		* and sets the default node attributes
+		*/
+		void Finish()
+		{
+			uint32_t n = offset.size() - 1;
+			std::vector<std::pair<nodeID_t, Edge> > sorted;
+			uint32_t k = 0;
+			for (nodeID_t i = 0; i < n; i++)
+			{
+				uint32_t first = offset[i], last = offset[i + 1];
+				if (!std::is_sorted(edges.begin() + first, edges.begin() + last))
+				{
+					sorted.clear();
+					for (uint32_t e = first; e < last; e++)
+						sorted.push_back(std::make_pair(edges[e], (Edge)edge_attr[e]));
+					std::stable_sort(sorted.begin(), sorted.end(),
+						[](const std::pair<nodeID_t, Edge> &a, const std::pair<nodeID_t, Edge> &b) {
+							return a.first < b.first;
+						});
+					for (uint32_t e = first; e < last; e++)
+					{
+						edges[e] = sorted[e - first].first;
+						edge_attr[e] = sorted[e - first].second;
+					}
+				}
+
+				offset[i] = k;
+				for (uint32_t e = first; e < last; e++)
+				{
+					if (k > offset[i] && edges[k - 1] == edges[e])
+						continue;
+					edges[k] = edges[e];
+					edge_attr[k] = edge_attr[e];
+					k++;
+				}
+			}
+			offset[n] = k;
+			edges.resize(k);
+			edge_attr.resize(k);
+			attr.resize(n);
+		}
+
+		static void FormatError(const char *line)
+		{
+			const char *end = line;
+			while (!TextScanner::IsEnd(*end))
+				end++;
+			error("File format error\n  Line: %.*s", (int)(end - line), line);
+		}
+
+	public:
+		virtual uint32_t NodeCount() const
+		{
+			return offset.size() - 1;
+		}
+
+		virtual Node GetNodeAttr(nodeID_t node)
+		{
+			return attr[node];
+		}
+
+		virtual uint32_t OutEdgeCount(nodeID_t node) const
+		{
+			return offset[node + 1] - offset[node];
+		}
+
+		virtual nodeID_t GetOutEdge(nodeID_t node, uint32_t i, Edge *pattr)
+		{
+			if (pattr)
+				*pattr = edge_attr[offset[node] + i];
+			return edges[offset[node] + i];
+		}
+	};
+
+	/**
+	* @class EdgeListARGLoader
+	* @brief Loader of edge lists.
+	*/
+	template <typename Node, typename Edge>
+	class EdgeListARGLoader : public CSRARGLoader<Node, Edge>
+	{
+	public:
+		/**
+		* @param path Path of the file.
+		* @param undirected Whether each edge is added in both directions.
+		*/
+		EdgeListARGLoader(const char *path, bool undirected = false)
+		{
+			TextLineReader reader(path, "#%");
+			std::vector<nodeID_t> source, target;
+			AttrVector<Edge> attrs;
+			uint32_t n = 0;
+			const char *line;
+			while ((line = reader.Next()) != NULL)
+			{
+				int64_t id1, id2;
+				bool ok = true;
+				const char *p = TextScanner::ParseInt(line, id1, ok);
+				p = TextScanner::ParseInt(p, id2, ok);
+				if (!ok || id1 < 0 || id2 < 0 || id1 >= NULL_NODE || id2 >= NULL_NODE)
+					this->FormatError(line);
+				Edge a = Edge();
+				TextField<Edge>::Parse(p, a);
+
+				source.push_back(id1);
+				target.push_back(id2);
+				attrs.push_back(a);
+				if (undirected && id1 != id2)
+				{
+					source.push_back(id2);
+					target.push_back(id1);
+					attrs.push_back(a);
+				}
+				n = std::max(n, (uint32_t)std::max(id1, id2) + 1);
+			}
+			this->Scatter(n, source, target, attrs);
+			this->Finish();
+		}
+	};
+
+	/**
+	* @class MatrixMarketARGLoader
+	* @brief Loader of MatrixMarket coordinate files.
+	*/
+	template <typename Node, typename Edge>
+	class MatrixMarketARGLoader : public CSRARGLoader<Node, Edge>
+	{
+	public:
+		/**
+		* @brief Tells whether a file starts with the MatrixMarket banner.
+		*/
+		static bool IsMatrixMarket(const char *path)
+		{
+			char banner[15];
+			FILE *f = fopen(path, "rb");
+			if (!f)
+				return false;
+			bool found = fread(banner, 1, 14, f) == 14 && !memcmp(banner, "%%MatrixMarket", 14);
+			fclose(f);
+			return found;
+		}
+
+		MatrixMarketARGLoader(const char *path)
+		{
+			//Banner: %%MatrixMarket matrix coordinate <field> <symmetry>
+			char line[1024] = "";
+			FILE *f = fopen(path, "rb");
+			if (!f || !fgets(line, sizeof(line), f))
+				error("Unable to read %s", path);
+			fclose(f);
+			std::string banner(line);
+			std::transform(banner.begin(), banner.end(), banner.begin(), ::tolower);
+			if (banner.compare(0, 14, "%%matrixmarket") || banner.find(" coordinate") == std::string::npos)
+				error("%s is not a MatrixMarket coordinate file", path);
+			bool mirror = banner.find("symmetric") != std::string::npos ||
+				banner.find("hermitian") != std::string::npos;
+
+			TextLineReader reader(path, "%");
+			const char *size = reader.Next();
+			if (!size)
+				error("End of file or reading error");
+			int64_t rows, cols, entries;
+			bool ok = true;
+			const char *p = TextScanner::ParseInt(size, rows, ok);
+			p = TextScanner::ParseInt(p, cols, ok);
+			TextScanner::ParseInt(p, entries, ok);
+			if (!ok || rows < 0 || cols < 0 || entries < 0 || std::max(rows, cols) >= NULL_NODE)
+				this->FormatError(size);
+			uint32_t n = std::max(rows, cols);
+
+			std::vector<nodeID_t> source, target;
+			AttrVector<Edge> attrs;
+			source.reserve(entries);
+			target.reserve(entries);
+			attrs.reserve(entries);
+			for (int64_t k = 0; k < entries; k++)
+			{
+				const char *entry = reader.Next();
+				if (!entry)
+					error("End of file or reading error");
+				int64_t i, j;
+				p = TextScanner::ParseInt(entry, i, ok);
+				p = TextScanner::ParseInt(p, j, ok);
+				if (!ok || i < 1 || j < 1 || i > n || j > n)
+					this->FormatError(entry);
+				Edge a = Edge();
+				TextField<Edge>::Parse(p, a);
+
+				source.push_back(i - 1);
+				target.push_back(j - 1);
+				attrs.push_back(a);
+				if (mirror && i != j)
+				{
+					source.push_back(j - 1);
+					target.push_back(i - 1);
+					attrs.push_back(a);
+				}
+			}
+			this->Scatter(n, source, target, attrs);
+			this->Finish();
+		}
+	};
+
+	/**
+	* @class LADARGLoader
+	* @brief Loader of LAD text files.
+	*/
+	template <typename Node, typename Edge>
+	class LADARGLoader : public CSRARGLoader<Node, Edge>
+	{
+	public:
+		LADARGLoader(const char *path)
+		{
+			TextLineReader reader(path);
+			const char *line = reader.Next();
+			if (!line)
+				error("End of file or reading error");
+			int64_t count;
+			bool ok = true;
+			TextScanner::ParseInt(line, count, ok);
+			if (!ok || count < 0 || count >= NULL_NODE)
+				this->FormatError(line);
+			uint32_t n = count;
+
+			this->offset.assign(n + 1, 0);
+			for (nodeID_t i = 0; i < n; i++)
+			{
+				line = reader.Next();
+				if (!line)
+					error("End of file or reading error");
+				int64_t degree, id;
+				const char *p = TextScanner::ParseInt(line, degree, ok);
+				for (int64_t j = 0; j < degree && ok; j++)
+				{
+					p = TextScanner::ParseInt(p, id, ok);
+					if (id < 0 || id >= n)
+						ok = false;
+					this->edges.push_back(id);
+				}
+				if (!ok || degree < 0)
+					this->FormatError(line);
+				this->offset[i + 1] = this->edges.size();
+			}
+			this->edge_attr.resize(this->edges.size());
+			this->Finish();
+		}
+	};
+
+	/**
+	* @class MiviaBinaryARGLoader
+	* @brief Loader of the MIVIA binary files, with 16 or 32 bits words.
+	*/
+	template <typename Node, typename Edge>
+	class MiviaBinaryARGLoader : public CSRARGLoader<Node, Edge>
+	{
+	private:
+		static const size_t BLOCK_SIZE = 1 << 20;
+
+		FILE *f;
+		const char *path;
+		unsigned int word_size;
+		std::vector<unsigned char> buffer;
+		size_t begin, end;
+
+		uint32_t NextWord()
+		{
+			if (end - begin < word_size)
+			{
+				memmove(buffer.data(), buffer.data() + begin, end - begin);
+				end -= begin;
+				begin = 0;
+				end += fread(buffer.data() + end, 1, buffer.size() - end, f);
+				if (end < word_size)
+					error("End of file or reading error");
+			}
+			const unsigned char *w = buffer.data() + begin;
+			begin += word_size;
+			if (word_size == 2)
+				return w[0] | (w[1] << 8);
+			return w[0] | (w[1] << 8) | (w[2] << 16) | ((uint32_t)w[3] << 24);
+		}
+
+	public:
+		/**
+		* @param path Path of the file.
+		* @param word_size Bytes of each word, 2 or 4.
+		*/
+		MiviaBinaryARGLoader(const char *path, unsigned int word_size = 2):
+			path(path), word_size(word_size), buffer(BLOCK_SIZE), begin(0), end(0)
+		{
+			f = fopen(path, "rb");
+			if (!f)
+				error("Unable to open %s", path);
+
+			uint32_t n = NextWord();
+			if (n == NULL_NODE)
+				error("File format error in %s", path);
+			this->offset.assign(n + 1, 0);
+			for (nodeID_t i = 0; i < n; i++)
+			{
+				uint32_t degree = NextWord();
+				for (uint32_t j = 0; j < degree; j++)
+				{
+					nodeID_t id = NextWord();
+					if (id >= n)
+						error("File format error in %s: edge %d -> %d", path, (int)i, (int)id);
+					this->edges.push_back(id);
+				}
+				this->offset[i + 1] = this->edges.size();
+			}
+			fclose(f);
+			this->edge_attr.resize(this->edges.size());
+			this->Finish();
+		}
+	};
+
+	/**
+	* @brief Loads a graph in a given format.
+	* @details With FORMAT_AUTO the binary graph files and the MatrixMarket files are
+	* recognized from their first bytes, the other files are read as .grf.
+	* The .grf files are read with the FastARGLoader, or with the DirectGraphLoader
+	* when low_memory is set.
+	* @param threads Threads used while loading, 0 for the number of cpus.
+	* @returns The graph, owned by the caller.
+	*/
+	template <typename Node, typename Edge>
+	ARGraph<Node, Edge>* LoadGraph(const char *path, GraphFormat format,
+		unsigned int threads = 0, bool low_memory = false)
+	{
+		if (format == FORMAT_AUTO)
+		{
+			if (GraphFile<Node, Edge>::IsGraphFile(path))
+				return GraphFile<Node, Edge>::Load(path);
+			format = MatrixMarketARGLoader<Node, Edge>::IsMatrixMarket(path) ? FORMAT_MATRIX_MARKET : FORMAT_GRF;
+		}
+
+		switch (format)
+		{
+		case FORMAT_EDGE_LIST:
+		{
+			EdgeListARGLoader<Node, Edge> loader(path);
+			return new ARGraph<Node, Edge>(&loader, threads);
+		}
+		case FORMAT_MATRIX_MARKET:
+		{
+			MatrixMarketARGLoader<Node, Edge> loader(path);
+			return new ARGraph<Node, Edge>(&loader, threads);
+		}
+		case FORMAT_LAD:
+		{
+			LADARGLoader<Node, Edge> loader(path);
+			return new ARGraph<Node, Edge>(&loader, threads);
+		}
+		case FORMAT_MIVIA16:
+		case FORMAT_MIVIA32:
+		{
+			MiviaBinaryARGLoader<Node, Edge> loader(path, format == FORMAT_MIVIA16 ? 2 : 4);
+			return new ARGraph<Node, Edge>(&loader, threads);
+		}
+		default:
+			break;
+		}
+
+		if (low_memory)
+			return DirectGraphLoader<Node, Edge>::Load(path, threads);
+		FastARGLoader<Node, Edge> loader(path, threads);
+		return new ARGraph<Node, Edge>(&loader, threads);
+	}
+
+}
+
+#endif /* GRAPHFORMATS_HPP */
@@ -0,0 +1,392 @@
+/**
+ * @file   GraphReordering.hpp
+ * @brief  Relabeling of the nodes of a graph for memory locality.
+ * @details The ids of the nodes of a graph loaded from file follow the file order,
+ * so the neighbors of a node, and their entries in the arrays indexed by node
+ * (core set, classes), are scattered in memory. The orderings below renumber the
+ * nodes so that nodes visited together by the matching get close ids:
+ *  - degree: nodes sorted by decreasing degree, so the hubs share few cache lines;
+ *  - rcm: Reverse Cuthill-McKee, a breadth first visit from a low degree node
+ *    reducing the bandwidth of the adjacency matrix;
+ *  - gorder: greedy ordering in the spirit of Gorder, placing next the node with the
+ *    most edges and common in-neighbors with the last placed nodes.
+ * An ordering is the list of the original ids in the new order, thus the new id of
+ * order[k] is k and order maps the ids of the relabeled graph back to the original ones.
+ * Edge directions are ignored by the orderings.
+ */
+
+#ifndef GRAPHREORDERING_HPP
+#define GRAPHREORDERING_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ARGraph.hpp"
+
+namespace vflib
+{
+
+	enum ReorderingMethod
+	{
+		REORDER_NONE,
+		REORDER_DEGREE,
+		REORDER_RCM,
+		REORDER_GORDER
+	};
+
+	/**
+	* @brief Parses the name of an ordering: none, degree, rcm or gorder.
+	* @returns FALSE if the name is unknown.
+	*/
+	inline bool ParseReorderingMethod(const std::string &name, ReorderingMethod &method)
+	{
+		if (name == "none")
+			method = REORDER_NONE;
+		else if (name == "degree")
+			method = REORDER_DEGREE;
+		else if (name == "rcm")
+			method = REORDER_RCM;
+		else if (name == "gorder")
+			method = REORDER_GORDER;
+		else
+			return false;
+		return true;
+	}
+
+	/**
+	* @brief Nodes sorted by decreasing degree, ties broken by id.
+	*/
+	template <typename Node, typename Edge>
+	std::vector<nodeID_t> DegreeOrder(const ARGraph<Node, Edge> &g)
+	{
+		std::vector<nodeID_t> order(g.NodeCount());
+		for (nodeID_t i = 0; i < order.size(); i++)
+		{
+			order[i] = i;
+		}
+		std::stable_sort(order.begin(), order.end(), [&g](nodeID_t a, nodeID_t b) {
+			return g.EdgeCount(a) > g.EdgeCount(b);
+		});
+		return order;
+	}
+
+	/**
+	* @brief Reverse Cuthill-McKee ordering.
+	* Each connected component is visited breadth first starting from its node of
+	* minimum degree, enqueuing the neighbors by increasing degree; the whole
+	* visit is then reversed.
+	*/
+	template <typename Node, typename Edge>
+	std::vector<nodeID_t> RcmOrder(const ARGraph<Node, Edge> &g)
+	{
+		uint32_t n = g.NodeCount();
+		std::vector<nodeID_t> order;
+		std::vector<nodeID_t> neighbors;
+		std::vector<bool> visited(n, false);
+		order.reserve(n);
+
+		std::vector<nodeID_t> roots(n);
+		for (nodeID_t i = 0; i < n; i++)
+		{
+			roots[i] = i;
+		}
+		std::stable_sort(roots.begin(), roots.end(), [&g](nodeID_t a, nodeID_t b) {
+			return g.EdgeCount(a) < g.EdgeCount(b);
+		});
+
+		for (uint32_t r = 0; r < n; r++)
+		{
+			if (visited[roots[r]])
+				continue;
+
+			size_t head = order.size();
+			visited[roots[r]] = true;
+			order.push_back(roots[r]);
+			while (head < order.size())
+			{
+				nodeID_t node = order[head++];
+				neighbors.clear();
+				for (uint32_t i = 0; i < g.OutEdgeCount(node); i++)
+				{
+					neighbors.push_back(g.GetOutEdge(node, i));
+				}
+				for (uint32_t i = 0; i < g.InEdgeCount(node); i++)
+				{
+					neighbors.push_back(g.GetInEdge(node, i));
+				}
+				std::stable_sort(neighbors.begin(), neighbors.end(), [&g](nodeID_t a, nodeID_t b) {
+					return g.EdgeCount(a) < g.EdgeCount(b);
+				});
+
+				for (size_t i = 0; i < neighbors.size(); i++)
+				{
+					if (!visited[neighbors[i]])
+					{
+						visited[neighbors[i]] = true;
+						order.push_back(neighbors[i]);
+					}
+				}
+			}
+		}
+
+		std::reverse(order.begin(), order.end());
+		return order;
+	}
+
+	/**
+	* @class GorderBuilder
+	* @brief Greedy ordering in the spirit of Gorder.
+	* The score of a node is the number of its edges, and of its common in-neighbors,
+	* with the nodes in a sliding window of the last placed ones. The node of maximum
+	* score is placed next, ties broken by degree. The scores are kept in a lazy heap:
+	* an entry is pushed when a score grows, entries not matching the current score
+	* are fixed when they reach the top.
+	* In-neighbors with more than max(sqrt(n), MIN_HUB_DEGREE) out edges are not used
+	* for the common in-neighbors, as they would cost quadratic time while saying
+	* little about the locality.
+	*/
+	template <typename Node, typename Edge>
+	class GorderBuilder
+	{
+	private:
+		static const uint32_t MIN_HUB_DEGREE = 256;
+
+		struct Entry
+		{
+			int32_t score;
+			uint32_t degree;
+			nodeID_t node;
+
+			Entry(int32_t score, uint32_t degree, nodeID_t node):
+				score(score), degree(degree), node(node){}
+
+			bool operator<(const Entry &e) const
+			{
+				if (score != e.score)
+					return score < e.score;
+				if (degree != e.degree)
+					return degree < e.degree;
+				return node > e.node;
+			}
+		};
+
+		const ARGraph<Node, Edge> &g;
+		uint32_t n;
+		uint32_t hubDegree;
+		std::vector<int32_t> score;
+		std::vector<bool> placed;
+		std::priority_queue<Entry> heap;
+
+		void Add(nodeID_t node, int32_t delta)
+		{
+			if (placed[node])
+				return;
+			score[node] += delta;
+			if (delta > 0)
+				heap.push(Entry(score[node], g.EdgeCount(node), node));
+		}
+
+		/*
+		* Updates the scores of the nodes related to a node entering (delta 1)
+		* or leaving (delta -1) the window
+		*/
+		void Update(nodeID_t node, int32_t delta)
+		{
+			uint32_t i, j;
+			for (i = 0; i < g.OutEdgeCount(node); i++)
+			{
+				Add(g.GetOutEdge(node, i), delta);
+			}
+			for (i = 0; i < g.InEdgeCount(node); i++)
+			{
+				nodeID_t parent = g.GetInEdge(node, i);
+				Add(parent, delta);
+				if (g.OutEdgeCount(parent) > hubDegree)
+					continue;
+				for (j = 0; j < g.OutEdgeCount(parent); j++)
+				{
+					nodeID_t sibling = g.GetOutEdge(parent, j);
+					if (sibling != node)
+						Add(sibling, delta);
+				}
+			}
+		}
+
+		void RebuildHeap()
+		{
+			std::vector<Entry> entries;
+			entries.reserve(n);
+			for (nodeID_t i = 0; i < n; i++)
+			{
+				if (!placed[i])
+					entries.push_back(Entry(score[i], g.EdgeCount(i), i));
+			}
+			heap = std::priority_queue<Entry>(std::less<Entry>(), entries);
+		}
+
+		nodeID_t PopBest()
+		{
+			//Stale entries are dropped, so the heap is rebuilt when too large
+			if (heap.size() > 8 * (size_t)n)
+				RebuildHeap();
+
+			while (true)
+			{
+				Entry top = heap.top();
+				heap.pop();
+				if (placed[top.node] || top.score < score[top.node])
+					continue;
+				if (top.score > score[top.node])
+				{
+					heap.push(Entry(score[top.node], top.degree, top.node));
+					continue;
+				}
+				return top.node;
+			}
+		}
+
+	public:
+		GorderBuilder(const ARGraph<Node, Edge> &g): g(g), n(g.NodeCount())
+		{
+			hubDegree = (uint32_t)std::sqrt((double)n);
+			if (hubDegree < MIN_HUB_DEGREE)
+				hubDegree = MIN_HUB_DEGREE;
+		}
+
+		std::vector<nodeID_t> Build(uint32_t window)
+		{
+			std::vector<nodeID_t> order;
+			order.reserve(n);
+			score.assign(n, 0);
+			placed.assign(n, false);
+			RebuildHeap();
+
+			for (uint32_t k = 0; k < n; k++)
+			{
+				nodeID_t node = PopBest();
+				placed[node] = true;
+				order.push_back(node);
+
+				Update(node, 1);
+				if (k >= window)
+					Update(order[k - window], -1);
+			}
+			return order;
+		}
+	};
+
+	template <typename Node, typename Edge>
+	std::vector<nodeID_t> GorderOrder(const ARGraph<Node, Edge> &g, uint32_t window = 5)
+	{
+		GorderBuilder<Node, Edge> builder(g);
+		return builder.Build(window);
+	}
+
+	/**
+	* @brief Ordering of the nodes of a graph.
+	* @returns Original ids in the new order, the identity for REORDER_NONE.
+	*/
+	template <typename Node, typename Edge>
+	std::vector<nodeID_t> ComputeReordering(const ARGraph<Node, Edge> &g, ReorderingMethod method)
+	{
+		switch (method)
+		{
+		case REORDER_DEGREE:
+			return DegreeOrder(g);
+		case REORDER_RCM:
+			return RcmOrder(g);
+		case REORDER_GORDER:
+			return GorderOrder(g);
+		default:
+			break;
+		}
+
+		std::vector<nodeID_t> order(g.NodeCount());
+		for (nodeID_t i = 0; i < order.size(); i++)
+		{
+			order[i] = i;
+		}
+		return order;
+	}
+
+	/**
+	* @class RelabeledARGLoader
+	* @brief ARGLoader exposing a graph with its nodes renumbered.
+	* Node k of the loader is node order[k] of the graph. The edges are kept with
+	* their attributes and the out edges of each node are sorted by the new ids.
+	* The graph must outlive the loader.
+	*/
+	template <typename Node, typename Edge>
+	class RelabeledARGLoader : public ARGLoader<Node, Edge>
+	{
+	private:
+		ARGraph<Node, Edge> &g;
+		std::vector<nodeID_t> order;
+		std::vector<uint32_t> offset;
+		std::vector<std::pair<nodeID_t, Edge> > edges;
+
+	public:
+		RelabeledARGLoader(ARGraph<Node, Edge> &g, const std::vector<nodeID_t> &order):
+			g(g), order(order)
+		{
+			uint32_t n = g.NodeCount();
+			uint32_t k, j;
+			std::vector<nodeID_t> new_id(n);
+			for (k = 0; k < n; k++)
+			{
+				new_id[order[k]] = k;
+			}
+
+			offset.resize(n + 1);
+			offset[0] = 0;
+			for (k = 0; k < n; k++)
+			{
+				offset[k + 1] = offset[k] + g.OutEdgeCount(order[k]);
+			}
+
+			edges.resize(offset[n]);
+			for (k = 0; k < n; k++)
+			{
+				for (j = 0; j < g.OutEdgeCount(order[k]); j++)
+				{
+					std::pair<nodeID_t, Edge> &e = edges[offset[k] + j];
+					e.first = new_id[g.GetOutEdge(order[k], j, e.second)];
+				}
+				std::sort(edges.begin() + offset[k], edges.begin() + offset[k + 1],
+					[](const std::pair<nodeID_t, Edge> &a, const std::pair<nodeID_t, Edge> &b) {
+						return a.first < b.first;
+					});
+			}
+		}
+
+		virtual uint32_t NodeCount() const
+		{
+			return order.size();
+		}
+
+		virtual Node GetNodeAttr(nodeID_t node)
+		{
+			return g.GetNodeAttr(order[node]);
+		}
+
+		virtual uint32_t OutEdgeCount(nodeID_t node) const
+		{
+			return offset[node + 1] - offset[node];
+		}
+
+		virtual nodeID_t GetOutEdge(nodeID_t node, uint32_t i, Edge *pattr)
+		{
+			const std::pair<nodeID_t, Edge> &e = edges[offset[node] + i];
+			if (pattr)
+				*pattr = e.second;
+			return e.first;
+		}
+	};
+
+}
+
+#endif /* GRAPHREORDERING_HPP */
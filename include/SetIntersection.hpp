@@ -0,0 +1,172 @@
+/**
+ * @file   SetIntersection.hpp
+ * @brief  Kernels intersecting sorted lists of nodes.
+ * @details The neighbors of a node are stored sorted by node id, thus the target
+ * nodes adjacent to several matched nodes can be found intersecting their lists.
+ * Lists of similar sizes are merged, 8 elements per list at time when the cpu
+ * supports AVX2; when a list is much shorter than the other its elements are
+ * looked for in the longer one by galloping (exponential and then binary search),
+ * so that the cost depends on the shorter list.
+ * The lists are assumed to be sorted and without duplicates.
+ */
+
+#ifndef SETINTERSECTION_HPP
+#define SETINTERSECTION_HPP
+
+#include <stdint.h>
+#include <algorithm>
+
+#include "ARGraph.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define VF_SET_INTERSECTION_SIMD
+#include <immintrin.h>
+#endif
+
+namespace vflib
+{
+
+	/**
+	* @brief Kernel writing into out the nodes both in a and b, returning their number.
+	* out must have room for the shorter list and must not overlap a or b.
+	*/
+	typedef uint32_t(*IntersectKernel)(const nodeID_t *a, uint32_t na,
+		const nodeID_t *b, uint32_t nb, nodeID_t *out);
+
+	//Ratio between the lengths of the lists above which galloping is used
+	static const uint32_t GALLOPING_RATIO = 32;
+
+	inline uint32_t IntersectMergeScalar(const nodeID_t *a, uint32_t na,
+		const nodeID_t *b, uint32_t nb, nodeID_t *out)
+	{
+		uint32_t i = 0, j = 0, k = 0;
+		while (i < na && j < nb)
+		{
+			if (a[i] < b[j])
+				i++;
+			else if (b[j] < a[i])
+				j++;
+			else
+			{
+				out[k++] = a[i];
+				i++;
+				j++;
+			}
+		}
+		return k;
+	}
+
+#ifdef VF_SET_INTERSECTION_SIMD
+	/*
+	* Compares a block of a with all the rotations of a block of b, then
+	* moves forward the block (or both) with the smaller last element.
+	*/
+	__attribute__((target("avx2")))
+	inline uint32_t IntersectMergeAVX2(const nodeID_t *a, uint32_t na,
+		const nodeID_t *b, uint32_t nb, nodeID_t *out)
+	{
+		const __m256i rotate = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+		uint32_t i = 0, j = 0, k = 0;
+		while (i + 8 <= na && j + 8 <= nb)
+		{
+			__m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+			__m256i vb = _mm256_loadu_si256((const __m256i*)(b + j));
+			__m256i hit = _mm256_cmpeq_epi32(va, vb);
+			for (int r = 1; r < 8; r++)
+			{
+				vb = _mm256_permutevar8x32_epi32(vb, rotate);
+				hit = _mm256_or_si256(hit, _mm256_cmpeq_epi32(va, vb));
+			}
+
+			int mask = _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+			while (mask)
+			{
+				out[k++] = a[i + __builtin_ctz(mask)];
+				mask &= mask - 1;
+			}
+
+			nodeID_t last_a = a[i + 7];
+			nodeID_t last_b = b[j + 7];
+			if (last_a <= last_b)
+				i += 8;
+			if (last_b <= last_a)
+				j += 8;
+		}
+		return k + IntersectMergeScalar(a + i, na - i, b + j, nb - j, out + k);
+	}
+#endif
+
+	/**
+	* @brief Intersection of a short list a with a long list b.
+	*/
+	inline uint32_t IntersectGalloping(const nodeID_t *a, uint32_t na,
+		const nodeID_t *b, uint32_t nb, nodeID_t *out)
+	{
+		uint32_t j = 0, k = 0;
+		for (uint32_t i = 0; i < na && j < nb; i++)
+		{
+			nodeID_t x = a[i];
+			uint32_t bound = 1;
+			while (j + bound < nb && b[j + bound] < x)
+				bound <<= 1;
+
+			const nodeID_t *last = b + std::min(j + bound + 1, nb);
+			j = std::lower_bound(b + j + bound / 2, last, x) - b;
+			if (j < nb && b[j] == x)
+			{
+				out[k++] = x;
+				j++;
+			}
+		}
+		return k;
+	}
+
+	/**
+	* @brief Chooses the merge kernel supported by the cpu.
+	*/
+	inline IntersectKernel SelectIntersectMerge()
+	{
+#ifdef VF_SET_INTERSECTION_SIMD
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			return IntersectMergeAVX2;
+#endif
+		return IntersectMergeScalar;
+	}
+
+	/*
+	* Holder of the merge kernel chosen at startup.
+	*/
+	template <int Unused = 0>
+	struct SetIntersectionDispatch
+	{
+		static const IntersectKernel merge;
+	};
+
+	template <int Unused>
+	const IntersectKernel SetIntersectionDispatch<Unused>::merge = SelectIntersectMerge();
+
+	/**
+	* @brief Intersects two sorted lists of nodes.
+	* @param [out] out Common nodes, in increasing order. Must have room for
+	* min(na, nb) nodes and must not overlap the lists.
+	* @returns Number of common nodes.
+	*/
+	inline uint32_t IntersectSorted(const nodeID_t *a, uint32_t na,
+		const nodeID_t *b, uint32_t nb, nodeID_t *out)
+	{
+		if (na > nb)
+		{
+			std::swap(a, b);
+			std::swap(na, nb);
+		}
+		if (!na)
+			return 0;
+		if (nb / na >= GALLOPING_RATIO)
+			return IntersectGalloping(a, na, b, nb, out);
+		return SetIntersectionDispatch<>::merge(a, na, b, nb, out);
+	}
+
+}
+
+#endif /* SETINTERSECTION_HPP */
@@ -13,6 +13,8 @@
 #include <iostream>
 #include <vector>
 #include <ARGraph.hpp>
+#include <CandidateFilter.hpp>
+#include <SetIntersection.hpp>
 #include <VF3State.hpp>
 #include <State.hpp>
 
@@ -51,6 +53,12 @@ namespace vflib
 		//Each class has its set
 		uint32_t last_candidate_index;
 
+		//Candidates of each depth, i.e. the target nodes adjacent to the images
+		//of all the matched neighbors of the node. Shared by the copies, since
+		//there is a single state at each depth being explored.
+		std::vector<nodeID_t> *candidates;
+		std::vector<nodeID_t> *candidate_scratch;
+
 		/* Structures for classes */
 		uint32_t *class_1;       //Classes for nodes of the first graph
 		uint32_t *class_2;       //Classes for nodes of the first graph
@@ -59,6 +67,9 @@ namespace vflib
 		//PRIVATE METHODS
 		void BackTrack();
 		void ComputeFirstGraphTraversing();
+		void BuildCandidateSet(nodeID_t node1);
+		void IntersectCandidates(const nodeID_t *set, uint32_t set_size);
+		const nodeID_t* NeighborsOfClass(nodeID_t node2, nodeDir_t dir, uint32_t c, uint32_t &count);
 
 	public:
 		static long long instance_count;
@@ -109,6 +120,8 @@ namespace vflib
 
 		dir = new nodeDir_t[n1];
 		predecessors = new nodeID_t[n1];
+		candidates = new std::vector<nodeID_t>[n1];
+		candidate_scratch = new std::vector<nodeID_t>();
 
 		ComputeFirstGraphTraversing();
 	}
@@ -144,6 +157,8 @@ namespace vflib
 
 		dir = state.dir;
 		predecessors = state.predecessors;
+		candidates = state.candidates;
+		candidate_scratch = state.candidate_scratch;
 		share_count = state.share_count;
 
 		++ *share_count;
@@ -169,6 +184,8 @@ namespace vflib
 			delete[] dir;
 			delete[] predecessors;
 			delete[] core_len_c;
+			delete[] candidates;
+			delete candidate_scratch;
 		}
 	}
 
@@ -270,10 +287,7 @@ namespace vflib
 	{
 
 		nodeID_t curr_n1;
-		nodeID_t pred_pair; //Node mapped with the predecessor
-		nodeID_t pred_set_size = 0;
 		int32_t c = 0;
-		pred_pair = NULL_NODE;
 
 		//core_len indica la profondondita' della ricerca
 		curr_n1 = order[core_len];
@@ -281,46 +295,21 @@ namespace vflib
 
 		if (predecessors[curr_n1] != NULL_NODE)
 		{
+			std::vector<nodeID_t> &cand = candidates[core_len];
 			if (prev_n2 == NULL_NODE)
+			{
 				last_candidate_index = 0;
+				BuildCandidateSet(curr_n1);
+			}
 			else {
 				last_candidate_index++; //Next Element
 			}
 
-			pred_pair = core_1[predecessors[curr_n1]];
-			switch (dir[curr_n1])
-			{
-			case NODE_DIR_IN:
-				pred_set_size = g2->InEdgeCount(pred_pair);
-
-				while (last_candidate_index < pred_set_size)
-				{
-					prev_n2 = g2->GetInEdge(pred_pair, last_candidate_index);
-					if (core_2[prev_n2] != NULL_NODE || class_2[prev_n2] != c)
-						last_candidate_index++;
-					else
-						break;
-				}
-
-				break;
-
-			case NODE_DIR_OUT:
-				pred_set_size = g2->OutEdgeCount(pred_pair);
-
-				while (last_candidate_index < pred_set_size)
-				{
-					prev_n2 = g2->GetOutEdge(pred_pair, last_candidate_index);
-					if (core_2[prev_n2] != NULL_NODE || class_2[prev_n2] != c)
-						last_candidate_index++;
-					else
-						break;
-				}
-
-				break;
-			}
-
-			if (last_candidate_index >= pred_set_size)
+			last_candidate_index = NextCandidate(cand.data(), last_candidate_index, cand.size(),
+				core_2, class_2, c);
+			if (last_candidate_index >= cand.size())
 				return false;
+			prev_n2 = cand[last_candidate_index];
 
 		}
 		else
@@ -331,12 +320,7 @@ namespace vflib
 			else
 				prev_n2++;
 
-			while (prev_n2 < n2 &&
-				(core_2[prev_n2] != NULL_NODE
-					|| class_2[prev_n2] != c))
-			{
-				prev_n2++;
-			}
+			prev_n2 = NextFreeCandidate(prev_n2, n2, core_2, class_2, c);
 		}
 		//std::cout<<curr_n1 << " " << prev_n2 << " \n";
 
@@ -351,6 +335,118 @@ namespace vflib
 	}
 
 
+	/*---------------------------------------------------------------
+	 * void VF3LightSubState::BuildCandidateSet(node1)
+	 * Fills the candidate set of the current depth with the target
+	 * nodes having an edge with the image of each matched neighbor
+	 * of node1, in the same direction. The lists of the images are
+	 * intersected starting from the shortest one.
+	 * The set is a superset of the nodes passing the edge checks of
+	 * IsFeasiblePair: matched and incompatible nodes are still there.
+	 --------------------------------------------------------------*/
+	template <typename Node1, typename Node2,
+		typename Edge1, typename Edge2,
+		typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+		void VF3LightSubState<Node1, Node2, Edge1, Edge2, NodeComparisonFunctor, EdgeComparisonFunctor>::BuildCandidateSet(nodeID_t node1)
+	{
+		std::vector<nodeID_t> &cand = candidates[core_len];
+		uint32_t c = class_1[node1];
+		const nodeID_t *shortest = NULL, *set;
+		uint32_t shortest_size = 0, set_size;
+		uint32_t i;
+		nodeID_t other2;
+
+		//An 'out' edge of node1 requires an 'in' edge of the image, and vice versa
+		for (i = 0; i < g1->OutEdgeCount(node1); i++)
+		{
+			other2 = core_1[g1->GetOutEdge(node1, i)];
+			if (other2 == NULL_NODE)
+				continue;
+			set = NeighborsOfClass(other2, NODE_DIR_IN, c, set_size);
+			if (!shortest || set_size < shortest_size)
+			{
+				shortest = set;
+				shortest_size = set_size;
+			}
+		}
+		for (i = 0; i < g1->InEdgeCount(node1); i++)
+		{
+			other2 = core_1[g1->GetInEdge(node1, i)];
+			if (other2 == NULL_NODE)
+				continue;
+			set = NeighborsOfClass(other2, NODE_DIR_OUT, c, set_size);
+			if (!shortest || set_size < shortest_size)
+			{
+				shortest = set;
+				shortest_size = set_size;
+			}
+		}
+
+		cand.assign(shortest, shortest + shortest_size);
+
+		for (i = 0; i < g1->OutEdgeCount(node1) && cand.size(); i++)
+		{
+			other2 = core_1[g1->GetOutEdge(node1, i)];
+			if (other2 == NULL_NODE)
+				continue;
+			set = NeighborsOfClass(other2, NODE_DIR_IN, c, set_size);
+			if (set != shortest)
+				IntersectCandidates(set, set_size);
+		}
+		for (i = 0; i < g1->InEdgeCount(node1) && cand.size(); i++)
+		{
+			other2 = core_1[g1->GetInEdge(node1, i)];
+			if (other2 == NULL_NODE)
+				continue;
+			set = NeighborsOfClass(other2, NODE_DIR_OUT, c, set_size);
+			if (set != shortest)
+				IntersectCandidates(set, set_size);
+		}
+	}
+
+	/*---------------------------------------------------------------
+	 * const nodeID_t* VF3LightSubState::NeighborsOfClass(node2, dir, c, count)
+	 * Neighbors of node2 in the given direction, restricted to the
+	 * class c when the target has the class index with the slices
+	 * sorted by node, as needed by the intersections.
+	 --------------------------------------------------------------*/
+	template <typename Node1, typename Node2,
+		typename Edge1, typename Edge2,
+		typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+		const nodeID_t* VF3LightSubState<Node1, Node2, Edge1, Edge2, NodeComparisonFunctor, EdgeComparisonFunctor>::NeighborsOfClass(nodeID_t node2, nodeDir_t dir, uint32_t c, uint32_t &count)
+	{
+		if (dir == NODE_DIR_IN)
+		{
+			if (g2->HasClassIndex() && !g2->ClassIndexByDegree())
+				return g2->GetInEdgeSetOfClass(node2, c, count);
+			count = g2->InEdgeCount(node2);
+			return g2->GetInEdgeSet(node2);
+		}
+		if (g2->HasClassIndex() && !g2->ClassIndexByDegree())
+			return g2->GetOutEdgeSetOfClass(node2, c, count);
+		count = g2->OutEdgeCount(node2);
+		return g2->GetOutEdgeSet(node2);
+	}
+
+	/*---------------------------------------------------------------
+	 * void VF3LightSubState::IntersectCandidates(set, set_size)
+	 * Keeps in the candidate set of the current depth only the
+	 * nodes belonging to the sorted set.
+	 --------------------------------------------------------------*/
+	template <typename Node1, typename Node2,
+		typename Edge1, typename Edge2,
+		typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+		void VF3LightSubState<Node1, Node2, Edge1, Edge2, NodeComparisonFunctor, EdgeComparisonFunctor>::IntersectCandidates(const nodeID_t *set, uint32_t set_size)
+	{
+		std::vector<nodeID_t> &cand = candidates[core_len];
+		candidate_scratch->resize(cand.size());
+		uint32_t count = IntersectSorted(cand.data(), cand.size(), set, set_size,
+			candidate_scratch->data());
+		candidate_scratch->resize(count);
+		cand.swap(*candidate_scratch);
+	}
+
+
 	/*---------------------------------------------------------------
 	 * bool VF3LightSubState::IsFeasiblePair(node1, node2)
 	 * Returns true if (node1, node2) can be added to the state
@@ -374,7 +470,8 @@ namespace vflib
 		assert(core_1[node1] == NULL_NODE);
 		assert(core_2[node2] == NULL_NODE);
 
-		if (!nf(g1->GetNodeAttr(node1), g2->GetNodeAttr(node2)))
+		if (!TrivialComparison<Node1, Node2, NodeComparisonFunctor>::value &&
+			!nf(g1->GetNodeAttr(node1), g2->GetNodeAttr(node2)))
 			return false;
 
 		if (g1->InEdgeCount(node1) > g2->InEdgeCount(node2)
@@ -384,17 +481,19 @@ namespace vflib
 		uint32_t i, other1, other2, c_other;
 		Edge1 eattr1;
 		Edge2 eattr2;
+		//Without attributes to compare the edges are only looked up
+		const bool edge_attr = !TrivialComparison<Edge1, Edge2, EdgeComparisonFunctor>::value;
 
 		// Check the 'out' edges of node1
 		for (i = 0; i < g1->OutEdgeCount(node1); i++)
 		{
-			other1 = g1->GetOutEdge(node1, i, eattr1);
+			other1 = edge_attr ? g1->GetOutEdge(node1, i, eattr1) : g1->GetOutEdge(node1, i);
 			c_other = class_1[other1];
 			if (core_1[other1] != NULL_NODE)
 			{
 				other2 = core_1[other1];
-				if (!g2->HasEdge(node2, other2, eattr2) ||
-					!ef(eattr1, eattr2))
+				if (edge_attr ? (!g2->HasEdge(node2, other2, eattr2) || !ef(eattr1, eattr2))
+					: !g2->HasEdge(node2, other2))
 					return false;
 			}
 		}
@@ -402,13 +501,13 @@ namespace vflib
 		// Check the 'in' edges of node1
 		for (i = 0; i < g1->InEdgeCount(node1); i++)
 		{
-			other1 = g1->GetInEdge(node1, i, eattr1);
+			other1 = edge_attr ? g1->GetInEdge(node1, i, eattr1) : g1->GetInEdge(node1, i);
 			c_other = class_1[other1];
 			if (core_1[other1] != NULL_NODE)
 			{
 				other2 = core_1[other1];
-				if (!g2->HasEdge(other2, node2, eattr2) ||
-					!ef(eattr1, eattr2))
+				if (edge_attr ? (!g2->HasEdge(other2, node2, eattr2) || !ef(eattr1, eattr2))
+					: !g2->HasEdge(other2, node2))
 					return false;
 			}
 		}
@@ -0,0 +1,87 @@
+/*
+ * IdleBackoff.hpp
+ */
+
+/*
+* Backoff policy for the idle workers of the parallel engines.
+* An idle worker first spins with an exponentially growing number of pause
+* instructions, then yields its time slice and finally asks to be parked.
+*/
+
+#ifndef IDLEBACKOFF_HPP
+#define IDLEBACKOFF_HPP
+
+#include <thread>
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace vflib {
+
+/*
+* @brief Reads the time stamp counter of the cpu.
+* On architectures without a cycle counter a nanoseconds clock is used.
+*/
+inline uint64_t ReadCycleCounter()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+inline void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	_mm_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+class IdleBackoff
+{
+private:
+	static const uint32_t SPIN_ROUNDS = 7;		//Up to 2^SPIN_ROUNDS pauses per round
+	static const uint32_t YIELD_ROUNDS = 16;
+	uint32_t step;
+
+public:
+	IdleBackoff():step(0){}
+
+	inline void Reset() { step = 0; }
+
+	/*
+	* @brief Waits for a while.
+	* @return TRUE if the worker has been idle long enough to be parked.
+	*/
+	inline bool Wait()
+	{
+		if (step < SPIN_ROUNDS)
+		{
+			for (uint32_t i = 0; i < (1u << step); i++)
+			{
+				CpuRelax();
+			}
+		}
+		else if (step < SPIN_ROUNDS + YIELD_ROUNDS)
+		{
+			std::this_thread::yield();
+		}
+		else
+		{
+			return true;
+		}
+		step++;
+		return false;
+	}
+};
+
+}
+
+#endif /* IDLEBACKOFF_HPP */
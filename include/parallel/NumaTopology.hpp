@@ -0,0 +1,156 @@
+/*
+ * NumaTopology.hpp
+ */
+
+/*
+* NUMA topology of the host, read from /sys/devices/system/node.
+* On systems without the sysfs node directory (or not Linux) the host is seen
+* as a single node holding all the cpus.
+*/
+
+#ifndef NUMATOPOLOGY_HPP
+#define NUMATOPOLOGY_HPP
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <thread>
+
+namespace vflib {
+
+class NumaTopology
+{
+private:
+	static const int MAX_NODES = 1024;
+
+	std::vector<std::vector<int> > nodeCpus;	//Cpus of each node, sorted
+	std::vector<int> cpuNode;					//Node of each cpu, -1 for cpus not listed
+
+	/*
+	* Parses a sysfs cpu list, e.g. "0-3,8-11"
+	*/
+	static std::vector<int> ParseCpuList(const std::string& list)
+	{
+		std::vector<int> cpus;
+		std::stringstream ss(list);
+		std::string range;
+		while (std::getline(ss, range, ','))
+		{
+			if (range.empty() || range[0] == '\n')
+				continue;
+
+			size_t dash = range.find('-');
+			int first = atoi(range.c_str());
+			int last = dash == std::string::npos ? first : atoi(range.c_str() + dash + 1);
+			for (int cpu = first; cpu <= last; cpu++)
+			{
+				cpus.push_back(cpu);
+			}
+		}
+		return cpus;
+	}
+
+public:
+	NumaTopology()
+	{
+		Discover();
+	}
+
+	void Discover()
+	{
+		nodeCpus.clear();
+		cpuNode.clear();
+
+#ifndef WIN32
+		//Node ids can have holes, empty nodes (memory only) are skipped
+		for (int node = 0; node < MAX_NODES; node++)
+		{
+			std::ostringstream path;
+			path << "/sys/devices/system/node/node" << node << "/cpulist";
+			std::ifstream in(path.str().c_str());
+			if (!in)
+				continue;
+
+			std::string list;
+			std::getline(in, list);
+			std::vector<int> cpus = ParseCpuList(list);
+			if (cpus.size())
+				nodeCpus.push_back(cpus);
+		}
+#endif
+
+		if (nodeCpus.empty())
+		{
+			unsigned int count = std::thread::hardware_concurrency();
+			nodeCpus.push_back(std::vector<int>());
+			for (unsigned int cpu = 0; cpu < (count ? count : 1); cpu++)
+			{
+				nodeCpus[0].push_back(cpu);
+			}
+		}
+
+		for (size_t node = 0; node < nodeCpus.size(); node++)
+		{
+			for (size_t i = 0; i < nodeCpus[node].size(); i++)
+			{
+				int cpu = nodeCpus[node][i];
+				if ((int)cpuNode.size() <= cpu)
+					cpuNode.resize(cpu + 1, -1);
+				cpuNode[cpu] = node;
+			}
+		}
+	}
+
+	inline size_t NodeCount() const { return nodeCpus.size(); }
+
+	inline const std::vector<int>& CpusOf(size_t node) const { return nodeCpus[node]; }
+
+	/*
+	* @brief Node of a cpu, 0 for unknown cpus
+	*/
+	inline int NodeOfCpu(int cpu) const
+	{
+		if (cpu < 0 || cpu >= (int)cpuNode.size() || cpuNode[cpu] < 0)
+			return 0;
+		return cpuNode[cpu];
+	}
+
+	/*
+	* @brief Spreads the threads over the nodes in proportion to their cpus.
+	* The threads of a node have consecutive ids and are pinned to distinct cpus
+	* of the node, as long as there are enough.
+	* @param [out] cpus Cpu of each thread
+	*/
+	void PlaceThreads(size_t threadCount, std::vector<int>& cpus) const
+	{
+		size_t totalCpus = 0;
+		for (size_t node = 0; node < nodeCpus.size(); node++)
+		{
+			totalCpus += nodeCpus[node].size();
+		}
+
+		cpus.clear();
+		size_t assigned = 0;
+		for (size_t node = 0; node < nodeCpus.size(); node++)
+		{
+			//Threads up to the end of this node, rounded to the nearest
+			size_t cpusSoFar = 0;
+			for (size_t k = 0; k <= node; k++)
+			{
+				cpusSoFar += nodeCpus[k].size();
+			}
+			size_t end = (threadCount * cpusSoFar + totalCpus / 2) / totalCpus;
+
+			for (size_t i = 0; assigned < end; i++, assigned++)
+			{
+				cpus.push_back(nodeCpus[node][i % nodeCpus[node].size()]);
+			}
+		}
+	}
+};
+
+}
+
+#endif /* NUMATOPOLOGY_HPP */
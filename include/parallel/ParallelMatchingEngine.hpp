@@ -7,6 +7,13 @@
 
 /*
 Parallel Matching Engine with global state stack only (no look-free stack)
+The termination is detected by an atomic count of the outstanding states,
+idle workers back off and are finally parked without taking the stack lock.
+The search can be stopped by the visitor or after a number of solutions: the
+workers stop expanding states and drain the queued ones.
+Optionally the workers are spread over the NUMA nodes and the target graph is
+replicated on each node, the states being bound to the replica of the node of
+the worker processing them.
 */
 
 #ifndef PARALLELMATCHINGTHREADPOOL_HPP
@@ -15,14 +22,19 @@ Parallel Matching Engine with global state stack only (no look-free stack)
 #include <atomic>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <array>
 #include <vector>
 #include <stack>
 #include <cstdint>
+#include <utility>
+#include <type_traits>
 
 #ifndef WIN32
 #include <unistd.h>
 #include <sys/time.h>
+#include <sched.h>
 #else
 #include <Windows.h>
 #include <stdint.h>
@@ -30,6 +42,9 @@ Parallel Matching Engine with global state stack only (no look-free stack)
 
 #include "ARGraph.hpp"
 #include "MatchingEngine.hpp"
+#include "IdleBackoff.hpp"
+#include "StateAllocator.hpp"
+#include "NumaTopology.hpp"
 
 namespace vflib {
 
@@ -47,20 +62,52 @@ protected:
 	using MatchingEngine<VFState>::solCount;
 	using MatchingEngine<VFState>::storeSolutions;
 	using MatchingEngine<VFState>::fist_solution_time;
+	typedef typename std::remove_pointer<decltype(std::declval<VFState&>().GetGraph2())>::type TargetGraph;
 
 	std::mutex statesMutex;
 	std::mutex solutionsMutex;
 	std::atomic<bool> once;
+	std::atomic<bool> cancelled;			//The search has been stopped, queued states are only drained
+	uint32_t solutionLimit;					//Solution count stopping the search, 0 for no limit
 
 	int16_t cpu;
 	int16_t numThreads;
 	std::vector<std::thread> pool;
-	std::atomic<int16_t> activeWorkerCount;
 	std::stack<VFState*> globalStateStack;
+	std::atomic<size_t> globalStackSize;	//Size of the global stack readable without the lock
+	std::atomic<int64_t> pendingStates;		//States generated but not yet processed
 	struct timeval time;
 
-	std::vector<bool> workerCountIncrement;
-	
+	//Parking of the idle workers
+	std::mutex parkMutex;
+	std::condition_variable parkCondition;
+	std::atomic<int16_t> parkedWorkers;
+
+	/*
+	* Cycles spent by each worker processing states and waiting for them.
+	* Padded to avoid false sharing between workers.
+	*/
+	struct WorkerCycles
+	{
+		uint64_t busy;
+		uint64_t idle;
+		char pad[64 - 2 * sizeof(uint64_t)];
+	};
+	std::vector<WorkerCycles> workerCycles;
+
+	//Records of the generated states, one arena for each worker plus one
+	//for the states generated before starting the pool
+	StateAllocator<VFState> stateAllocator;
+
+	//Placement of the workers
+	NumaTopology topology;
+	bool numaPlacement;						//Spread the workers over the NUMA nodes
+	bool replicateTarget;					//Replicate the target graph on each node of the workers
+	std::vector<int> workerCpu;				//Cpu of each worker, -1 if not pinned
+	std::vector<int16_t> workerNode;		//NUMA node of each worker
+	std::vector<TargetGraph*> targetReplicas;	//Target graph of each node, empty if not replicated
+	std::vector<bool> ownedReplicas;
+
 public:
 	ParallelMatchingEngine(unsigned short int numThreads, 
 		bool storeSolutions=false, 
@@ -68,16 +115,57 @@ public:
 		MatchingVisitor<VFState> *visit = NULL):
 		MatchingEngine<VFState>(visit, storeSolutions),
 		once(false),
+		cancelled(false),
+		solutionLimit(0),
 		cpu(cpu),
 		numThreads(numThreads),
 		pool(numThreads),
-		activeWorkerCount(0),
-		workerCountIncrement(numThreads,true){}
+		globalStackSize(0),
+		pendingStates(0),
+		parkedWorkers(0),
+		workerCycles(numThreads),
+		stateAllocator(numThreads + 1),
+		numaPlacement(false),
+		replicateTarget(false)
+	{
+		PlaceWorkers();
+	}
 
-	~ParallelMatchingEngine(){}
+	~ParallelMatchingEngine()
+	{
+		ReleaseReplicas();
+	}
+
+	/*
+	* @brief Sets the placement of the workers on the NUMA nodes.
+	* @param placement Spread the workers over the nodes, in proportion to their cpus,
+	* instead of pinning them to consecutive cpus starting from cpu.
+	* @param replicate Copy the target graph on each node with workers. Each replica is
+	* built by a thread running on its node, so that its pages are local to the node.
+	* It implies the placement.
+	*/
+	void SetNumaPolicy(bool placement, bool replicate)
+	{
+		numaPlacement = placement || replicate;
+		replicateTarget = replicate;
+		PlaceWorkers();
+	}
 
-	bool FindAllMatchings(VFState& s)
+	inline const NumaTopology& GetTopology() const
 	{
+		return topology;
+	}
+
+	virtual bool FindAllMatchings(VFState& s)
+	{
+		for (size_t i = 0; i < workerCycles.size(); i++)
+		{
+			workerCycles[i].busy = workerCycles[i].idle = 0;
+		}
+
+		cancelled.store(false);
+		stateAllocator.Init(s);
+		ReplicateTarget(s);
 		ProcessState(&s, NULL_THREAD);
 		StartPool();
 
@@ -92,6 +180,33 @@ public:
 		return true;
 	}
 
+	/*
+	* @brief Stops the search at the first solution found.
+	* @return TRUE If a solution has been found.
+	*/
+	bool FindFirstMatching(VFState& s)
+	{
+		return FindFirstK(s, 1) > 0;
+	}
+
+	/*
+	* @brief Stops the search after k solutions, k = 0 meaning all the solutions.
+	* @return Number of solutions found, at most k.
+	*/
+	size_t FindFirstK(VFState& s, uint32_t k)
+	{
+		uint32_t start = solCount;
+		solutionLimit = k ? start + k : 0;
+		FindAllMatchings(s);
+		solutionLimit = 0;
+		return solCount - start;
+	}
+
+	inline bool IsCancelled() const
+	{
+		return cancelled.load(std::memory_order_relaxed);
+	}
+
 	inline size_t GetThreadCount() const {
 		return pool.size();
 	}
@@ -102,44 +217,270 @@ public:
 		once = false;
 	}
 
-private: 
+	/*
+	* @brief Cycles spent by all the workers processing states
+	*/
+	inline uint64_t GetBusyCycles() const
+	{
+		uint64_t cycles = 0;
+		for (size_t i = 0; i < workerCycles.size(); i++)
+		{
+			cycles += workerCycles[i].busy;
+		}
+		return cycles;
+	}
+
+	/*
+	* @brief Cycles spent by all the workers waiting for states to process
+	*/
+	inline uint64_t GetIdleCycles() const
+	{
+		uint64_t cycles = 0;
+		for (size_t i = 0; i < workerCycles.size(); i++)
+		{
+			cycles += workerCycles[i].idle;
+		}
+		return cycles;
+	}
+
+protected:
 
 	inline unsigned GetRemainingStates() {
 		std::lock_guard<std::mutex> guard(statesMutex);
 		return globalStateStack.size();
 	}
 
-	void Run(ThreadId thread_id) 
+	virtual void Run(ThreadId thread_id)
 	{
 		VFState* s = NULL;
-		do
+		uint64_t idle_start = ReadCycleCounter();
+		while(GetState(&s, thread_id))
 		{
-			if(s)
+			uint64_t busy_start = ReadCycleCounter();
+			workerCycles[thread_id].idle += busy_start - idle_start;
+
+			if (!IsCancelled())
 			{
+				BindToWorkerNode(s, thread_id);
 				ProcessState(s, thread_id);
-				delete s;	
 			}
-		}while(GetState(&s, thread_id));
+			stateAllocator.Delete(s, thread_id);
+			StateDone();
+
+			idle_start = ReadCycleCounter();
+			workerCycles[thread_id].busy += idle_start - busy_start;
+		}
+		workerCycles[thread_id].idle += ReadCycleCounter() - idle_start;
+	}
+
+	/*
+	* Computes the cpu and the NUMA node of each worker
+	*/
+	void PlaceWorkers()
+	{
+		workerCpu.assign(numThreads, -1);
+		workerNode.assign(numThreads, 0);
+		if (numaPlacement)
+		{
+			topology.PlaceThreads(numThreads, workerCpu);
+		}
+		else if (cpu > -1)
+		{
+			for (int16_t i = 0; i < numThreads; i++)
+			{
+				workerCpu[i] = cpu + i;
+			}
+		}
+
+		for (int16_t i = 0; i < numThreads; i++)
+		{
+			workerNode[i] = topology.NodeOfCpu(workerCpu[i]);
+		}
+	}
+
+	void ReleaseReplicas()
+	{
+		for (size_t i = 0; i < targetReplicas.size(); i++)
+		{
+			if (ownedReplicas[i])
+				delete targetReplicas[i];
+		}
+		targetReplicas.clear();
+		ownedReplicas.clear();
+	}
+
+	/*
+	* Builds the replicas of the target graph of the initial state.
+	* The original graph is used on the node of the calling thread, that is assumed to have loaded it.
+	*/
+	void ReplicateTarget(VFState& s)
+	{
+		ReleaseReplicas();
+		if (!replicateTarget || topology.NodeCount() < 2)
+			return;
+
+		TargetGraph* target = s.GetGraph2();
+		int home = 0;
+#ifndef WIN32
+		home = topology.NodeOfCpu(sched_getcpu());
+#endif
+		targetReplicas.assign(topology.NodeCount(), target);
+		ownedReplicas.assign(topology.NodeCount(), false);
+
+		std::vector<bool> used(topology.NodeCount(), false);
+		for (int16_t i = 0; i < numThreads; i++)
+		{
+			used[workerNode[i]] = true;
+		}
+
+		for (size_t node = 0; node < topology.NodeCount(); node++)
+		{
+			if (!used[node] || (int)node == home)
+				continue;
+
+			//The builder moves to the node before touching the pages of the replica
+			TargetGraph** replica = &targetReplicas[node];
+			int node_cpu = topology.CpusOf(node)[0];
+			std::thread builder([this, replica, target, node_cpu]{
+#ifndef WIN32
+				SetAffinity(node_cpu, pthread_self());
+#endif
+				*replica = new TargetGraph(*target);
+			});
+			builder.join();
+			ownedReplicas[node] = true;
+		}
+	}
+
+	/*
+	* Makes the state use the replica of the target graph of the node of the worker.
+	* The children of the state inherit the replica.
+	*/
+	inline void BindToWorkerNode(VFState* s, ThreadId thread_id)
+	{
+		if (targetReplicas.size())
+		{
+			s->SetGraph2(targetReplicas[workerNode[thread_id]]);
+		}
+	}
+
+	inline size_t ArenaOf(ThreadId thread_id) const
+	{
+		return thread_id == NULL_THREAD ? numThreads : thread_id;
 	}
 
 	inline void GenerateState(VFState *s, nodeID_t n1, nodeID_t n2, ThreadId thread_id)
 	{
-		VFState* s1 = new VFState(*s);
+		VFState* s1 = stateAllocator.New(*s, ArenaOf(thread_id));
 		s1->AddPair(n1, n2);
+		pendingStates.fetch_add(1, std::memory_order_acq_rel);
 		PutState(s1, thread_id);
 	}
 
+	/*
+	* Stops the search. The queued states are drained by the workers.
+	*/
+	inline void Cancel()
+	{
+		if (!cancelled.exchange(true))
+		{
+			WakeWorkers(true);
+		}
+	}
+
+	/*
+	* Counts a solution, unless the limit has been reached.
+	* Returns FALSE if the solution must be discarded.
+	*/
+	inline bool CountSolution()
+	{
+		if (!solutionLimit)
+		{
+			solCount++;
+			return true;
+		}
+
+		uint32_t count = solCount.load();
+		do
+		{
+			if (count >= solutionLimit)
+			{
+				Cancel();
+				return false;
+			}
+		} while (!solCount.compare_exchange_weak(count, count + 1));
+
+		if (count + 1 == solutionLimit)
+		{
+			Cancel();
+		}
+		return true;
+	}
+
+	/*
+	* Marks a state as processed.
+	* The last outstanding state wakes up all the parked workers to let them exit.
+	*/
+	inline void StateDone(int64_t count = 1)
+	{
+		if (pendingStates.fetch_sub(count, std::memory_order_acq_rel) == count)
+		{
+			WakeWorkers(true);
+		}
+	}
+
+	inline bool IsSearchOver() const
+	{
+		return pendingStates.load(std::memory_order_acquire) == 0;
+	}
+
+	/*
+	* Returns TRUE if there could be a state that a parked worker is able to get.
+	*/
+	virtual bool IsWorkAvailable()
+	{
+		return globalStackSize.load() > 0;
+	}
+
+	inline void WakeWorkers(bool all)
+	{
+		if (parkedWorkers.load() > 0)
+		{
+			std::lock_guard<std::mutex> guard(parkMutex);
+			if (all)
+				parkCondition.notify_all();
+			else
+				parkCondition.notify_one();
+		}
+	}
+
+	/*
+	* Parks the calling worker until a new state is available or the search is over.
+	* The wait is bounded, thus a lost notification only delays the worker.
+	*/
+	inline void ParkWorker()
+	{
+		std::unique_lock<std::mutex> lock(parkMutex);
+		parkedWorkers++;
+		if (!IsWorkAvailable() && !IsSearchOver())
+		{
+			parkCondition.wait_for(lock, std::chrono::milliseconds(1));
+		}
+		parkedWorkers--;
+	}
+
 	bool ProcessState(VFState *s, ThreadId thread_id)
 	{
 		if (s->IsGoal())
 		{
+			if (!CountSolution())
+				return true;
+
 			if(!once.exchange(true, std::memory_order_acq_rel))
 			{
 				gettimeofday(&(this->fist_solution_time),NULL);
 			}
 
-			solCount++;
-
 			if(storeSolutions)
 			{
 				std::lock_guard<std::mutex> guard(solutionsMutex);
@@ -147,9 +488,9 @@ private:
 				s->GetCoreSet(sol);
 				solutions.push_back(sol);
 			}
-			if (visit)
+			if (visit && (*visit)(*s))
 			{
-				return (*visit)(*s);
+				Cancel();
 			}
 			return true;
 		}
@@ -158,7 +499,7 @@ private:
 			return false;
 
 		nodeID_t n1 = NULL_NODE, n2 = NULL_NODE;
-		while (s->NextPair(&n1, &n2, n1, n2))
+		while (!IsCancelled() && s->NextPair(&n1, &n2, n1, n2))
 		{
 			if (s->IsFeasiblePair(n1, n2))
 			{
@@ -169,37 +510,47 @@ private:
 		
 	}
 
-	void PutState(VFState* s, ThreadId thread_id) {
-		std::lock_guard<std::mutex> guard(statesMutex);
-		globalStateStack.push(s);
+	virtual void PutState(VFState* s, ThreadId thread_id) {
+		{
+			std::lock_guard<std::mutex> guard(statesMutex);
+			globalStateStack.push(s);
+			globalStackSize.store(globalStateStack.size());
+		}
+		WakeWorkers(false);
 	}
 
-	bool GetState(VFState** res, ThreadId thread_id)
+	inline bool PopGlobalState(VFState** res)
 	{
-		*res = NULL;
+		if (!globalStackSize.load(std::memory_order_relaxed))
+			return false;
+
 		std::lock_guard<std::mutex> stateLock(statesMutex);
-		
-		if(globalStateStack.size())
-		{
-			*res = globalStateStack.top();
-			globalStateStack.pop();
-			if(workerCountIncrement[thread_id])
-			{
-				activeWorkerCount++;
-				workerCountIncrement[thread_id]=false;
-			}
-		}
-		else
+		if (globalStateStack.empty())
+			return false;
+
+		*res = globalStateStack.top();
+		globalStateStack.pop();
+		globalStackSize.store(globalStateStack.size());
+		return true;
+	}
+
+	virtual bool GetState(VFState** res, ThreadId thread_id)
+	{
+		*res = NULL;
+		IdleBackoff backoff;
+
+		while (!PopGlobalState(res))
 		{
-			if(!workerCountIncrement[thread_id])
+			//No outstanding states means that nobody can generate new ones
+			if (IsSearchOver())
 			{
-				activeWorkerCount--;
-				workerCountIncrement[thread_id]=true;
+				return false;
 			}
 
-			if(activeWorkerCount <= 0)
+			if (backoff.Wait())
 			{
-				return false;
+				ParkWorker();
+				backoff.Reset();
 			}
 		}
 		return true;
@@ -221,17 +572,14 @@ private:
 
 	void StartPool()
 	{
-		int current_cpu = cpu; 
-
 		for (size_t i = 0; i < numThreads; ++i)
 		{
 			pool[i] = std::thread( [this,i]{ this->Run(i); } );
 #ifndef WIN32
-			//If cpu is not -1 set the thread affinity starting from the cpu
-			if(current_cpu > -1)
+			//Pinning the workers placed on a cpu
+			if(workerCpu[i] > -1)
 			{
-				SetAffinity(current_cpu, pool[i].native_handle());
-				current_cpu++;
+				SetAffinity(workerCpu[i], pool[i].native_handle());
 			}
 #endif
 		}
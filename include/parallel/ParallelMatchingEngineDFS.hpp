@@ -0,0 +1,332 @@
+/*
+ * ParallelMatchingEngineDFS.hpp
+ */
+
+/*
+* VF3P4
+* Parallel Matching Engine where each worker explores its subtree depth first on a single
+* mutable state, adding and removing pairs in place.
+* States are materialized only when some worker is idle (lazy task creation): the busy
+* worker takes a snapshot of the shallowest frame of its path that has not been shared yet,
+* gives the snapshot and the position of the frame among its candidates to the idle worker,
+* and stops iterating that frame by itself.
+*
+* The VFState must provide, besides the methods used by ParallelMatchingEngine:
+*  - void RemovePair(nodeID_t n1, nodeID_t n2), undoing the last AddPair;
+*  - int GetCandidateCursor() and void SetCandidateCursor(int), saving and restoring
+*    the position of NextPair in the candidates of the current depth.
+*/
+
+#ifndef PARALLELMATCHINGENGINEDFS_HPP
+#define PARALLELMATCHINGENGINEDFS_HPP
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <cstdint>
+
+#include "ARGraph.hpp"
+#include "ParallelMatchingEngine.hpp"
+
+namespace vflib {
+
+template<typename VFState>
+class ParallelMatchingEngineDFS
+		: public ParallelMatchingEngine<VFState>
+{
+private:
+	typedef ParallelMatchingEngine<VFState> Base;
+	using Base::numThreads;
+	using Base::pool;
+	using Base::workerCycles;
+	using Base::stateAllocator;
+
+	/*
+	* Position of the exploration at a depth of the path
+	*/
+	struct Frame
+	{
+		nodeID_t n1, n2;	//Last pair returned by NextPair
+		int cursor;			//Candidate cursor after the last pair
+		bool shared;		//The remaining candidates have been given to another worker
+
+		Frame(): n1(NULL_NODE), n2(NULL_NODE), cursor(0), shared(false) {}
+	};
+
+	/*
+	* A state to explore and the frame to resume its current depth from
+	*/
+	struct Task
+	{
+		VFState* state;
+		Frame resume;
+	};
+
+	/*
+	* Path of each worker. Padded to avoid false sharing between workers.
+	*/
+	struct Worker
+	{
+		std::vector<Frame> frames;
+		char pad[64];
+	};
+
+	std::vector<Worker*> workers;
+
+	std::mutex tasksMutex;
+	std::condition_variable tasksCondition;
+	std::vector<Task> tasks;
+	int16_t idleWorkers;				//Protected by tasksMutex
+	bool searchOver;					//Protected by tasksMutex
+	std::atomic<int32_t> hungryWorkers;	//Idle workers waiting for a task
+	std::atomic<int32_t> queuedTasks;	//Tasks not yet taken by a worker
+
+public:
+	ParallelMatchingEngineDFS(unsigned short int numThreads,
+		bool storeSolutions=false,
+		short int cpu = -1,
+		MatchingVisitor<VFState> *visit = NULL):
+		ParallelMatchingEngine<VFState>(numThreads, storeSolutions, cpu, visit),
+		workers(numThreads),
+		idleWorkers(0),
+		searchOver(false),
+		hungryWorkers(0),
+		queuedTasks(0)
+	{
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			workers[i] = new Worker();
+		}
+	}
+
+	~ParallelMatchingEngineDFS()
+	{
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			delete workers[i];
+		}
+	}
+
+	bool FindAllMatchings(VFState& s)
+	{
+		for (size_t i = 0; i < workerCycles.size(); i++)
+		{
+			workerCycles[i].busy = workerCycles[i].idle = 0;
+		}
+
+		Base::cancelled.store(false);
+		stateAllocator.Init(s);
+		Base::ReplicateTarget(s);
+		idleWorkers = 0;
+		searchOver = false;
+
+		Task root;
+		root.state = stateAllocator.New(s, Base::ArenaOf(NULL_THREAD));
+		PushTask(root);
+
+		Base::StartPool();
+
+		//Waiting for process thread
+		for (auto &th : pool) {
+			if (th.joinable()) {
+				th.join();
+			}
+		}
+
+		//Exiting
+		return true;
+	}
+
+private:
+
+	inline void PushTask(Task& task)
+	{
+		std::lock_guard<std::mutex> guard(tasksMutex);
+		tasks.push_back(task);
+		queuedTasks++;
+		tasksCondition.notify_one();
+	}
+
+	/*
+	* Waits for a task. Returns FALSE when all the workers are idle and no task is left.
+	*/
+	bool GetTask(Task& task)
+	{
+		std::unique_lock<std::mutex> lock(tasksMutex);
+		if (tasks.empty())
+		{
+			idleWorkers++;
+			hungryWorkers++;
+			if (idleWorkers == numThreads)
+			{
+				searchOver = true;
+				tasksCondition.notify_all();
+			}
+
+			while (tasks.empty() && !searchOver)
+			{
+				tasksCondition.wait(lock);
+			}
+
+			hungryWorkers--;
+			if (tasks.empty())
+			{
+				return false;
+			}
+			idleWorkers--;
+		}
+
+		task = tasks.back();
+		tasks.pop_back();
+		queuedTasks--;
+		return true;
+	}
+
+	inline bool IsSomeoneHungry() const
+	{
+		return hungryWorkers.load(std::memory_order_relaxed) >
+			queuedTasks.load(std::memory_order_relaxed);
+	}
+
+	/*
+	* Gives away the remaining candidates of the shallowest frame that has not been shared,
+	* if it has at least one candidate left.
+	* Frames from base to top are on the path of the state, the pair of each frame below
+	* the top is currently added to the state.
+	*/
+	void ShareWork(VFState* s, ThreadId thread_id, int base, int top)
+	{
+		std::vector<Frame>& frames = workers[thread_id]->frames;
+		for (int depth = base; depth <= top; depth++)
+		{
+			Frame& f = frames[depth];
+			if (f.shared)
+				continue;
+
+			//Snapshot of the path prefix up to this depth
+			VFState* snapshot = stateAllocator.New(*s, thread_id);
+			for (int d = top - 1; d >= depth; d--)
+			{
+				snapshot->RemovePair(frames[d].n1, frames[d].n2);
+			}
+
+			//Checking that a candidate is left
+			nodeID_t n1, n2;
+			snapshot->SetCandidateCursor(f.cursor);
+			bool left = snapshot->NextPair(&n1, &n2, f.n1, f.n2);
+			f.shared = true;
+
+			if (left)
+			{
+				Task task;
+				task.state = snapshot;
+				task.resume = f;
+				task.resume.shared = false;
+				PushTask(task);
+				return;
+			}
+			stateAllocator.Delete(snapshot, thread_id);
+		}
+	}
+
+	/*
+	* Explores the subtree of the task in place
+	*/
+	void Explore(Task& task, ThreadId thread_id)
+	{
+		VFState* s = task.state;
+		Base::BindToWorkerNode(s, thread_id);
+		if (s->IsGoal() || s->IsDead())
+		{
+			Base::ProcessState(s, thread_id);
+			return;
+		}
+
+		std::vector<Frame>& frames = workers[thread_id]->frames;
+		const int base = s->CoreLen();
+		int top = base;
+		if ((int)frames.size() <= top)
+		{
+			frames.resize(top + 1);
+		}
+		frames[top] = task.resume;
+
+		while (!Base::IsCancelled())
+		{
+			if (IsSomeoneHungry())
+			{
+				ShareWork(s, thread_id, base, top);
+			}
+
+			Frame& f = frames[top];
+			bool descended = false;
+			if (!f.shared)
+			{
+				nodeID_t n1, n2;
+				s->SetCandidateCursor(f.cursor);
+				while (!Base::IsCancelled() && s->NextPair(&n1, &n2, f.n1, f.n2))
+				{
+					f.n1 = n1;
+					f.n2 = n2;
+					f.cursor = s->GetCandidateCursor();
+					if (!s->IsFeasiblePair(n1, n2))
+						continue;
+
+					s->AddPair(n1, n2);
+					if (s->IsGoal() || s->IsDead())
+					{
+						Base::ProcessState(s, thread_id);
+						s->RemovePair(n1, n2);
+						continue;
+					}
+
+					top++;
+					if ((int)frames.size() <= top)
+					{
+						frames.resize(top + 1);
+					}
+					frames[top] = Frame();
+					descended = true;
+					break;
+				}
+			}
+
+			if (!descended)
+			{
+				//Frame exhausted, backtracking
+				if (top == base)
+					break;
+				top--;
+				s->RemovePair(frames[top].n1, frames[top].n2);
+			}
+		}
+	}
+
+	void Run(ThreadId thread_id)
+	{
+		Task task;
+		uint64_t idle_start = ReadCycleCounter();
+		while (GetTask(task))
+		{
+			uint64_t busy_start = ReadCycleCounter();
+			workerCycles[thread_id].idle += busy_start - idle_start;
+
+			//After a stop the queued tasks are only drained
+			if (!Base::IsCancelled())
+			{
+				Explore(task, thread_id);
+			}
+			stateAllocator.Delete(task.state, thread_id);
+
+			idle_start = ReadCycleCounter();
+			workerCycles[thread_id].busy += idle_start - busy_start;
+		}
+		workerCycles[thread_id].idle += ReadCycleCounter() - idle_start;
+	}
+};
+
+}
+
+#endif /* PARALLELMATCHINGENGINEDFS_HPP */
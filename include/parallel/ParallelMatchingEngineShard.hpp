@@ -0,0 +1,233 @@
+/*
+ * ParallelMatchingEngineShard.hpp
+ */
+
+/*
+* VF3PS
+* Matching Engine statically partitioning the search space at its first levels.
+* The states at the prefix depth (the root candidates, optionally with the second
+* level as well) are the independent subtrees of the search. They are numbered in
+* the order produced by NextPair, which is the same in every thread and in every
+* process, and subtree k belongs to shard k % shardCount. Inside a shard the
+* subtrees are interleaved among the threads, each one running the sequential
+* matching engine on its own states, thus the threads never synchronize until the
+* counts are merged.
+* Running shardCount processes with shardIndex from 0 to shardCount-1 covers the
+* whole search space, the total count being the sum of the counts of the shards.
+*
+* Since the copies of a sequential state share their arrays with the original one,
+* each thread builds its own initial state through a factory returning it by value.
+* The visitor, if any, is called concurrently by the threads.
+*/
+
+#ifndef PARALLELMATCHINGENGINESHARD_HPP
+#define PARALLELMATCHINGENGINESHARD_HPP
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/time.h>
+#else
+#include <Windows.h>
+#include <stdint.h>
+#endif
+
+#include "ARGraph.hpp"
+#include "MatchingEngine.hpp"
+
+namespace vflib {
+
+template<typename VFState>
+class ParallelMatchingEngineShard
+		: public MatchingEngine<VFState>
+{
+private:
+	using MatchingEngine<VFState>::solutions;
+	using MatchingEngine<VFState>::visit;
+	using MatchingEngine<VFState>::solCount;
+	using MatchingEngine<VFState>::storeSolutions;
+	using MatchingEngine<VFState>::fist_solution_time;
+
+	int16_t cpu;
+	int16_t numThreads;
+	uint32_t shardIndex;
+	uint32_t shardCount;
+	uint16_t prefixDepth;
+	std::vector<std::thread> pool;
+	std::mutex solutionsMutex;
+	bool firstSolutionFound;	//Protected by solutionsMutex
+
+	/*
+	* Sequential engine of a thread, also walking the prefix levels
+	*/
+	class ShardWorker: public MatchingEngine<VFState>
+	{
+	private:
+		uint64_t stride;	//Subtrees between two consecutive ones of the thread
+		uint64_t first;		//First subtree of the thread
+		uint64_t count;		//Subtrees met so far
+		uint16_t depth;
+
+	public:
+		ShardWorker(uint64_t stride, uint64_t first, uint16_t depth,
+			bool storeSolutions, MatchingVisitor<VFState> *visit):
+			MatchingEngine<VFState>(visit, storeSolutions),
+			stride(stride), first(first), count(0), depth(depth){}
+
+		/*
+		* Explores the subtrees of the thread below s.
+		* Returns TRUE if the visitor asked to stop.
+		*/
+		bool ExplorePrefix(VFState& s)
+		{
+			if (s.CoreLen() == depth || s.IsGoal() || s.IsDead())
+			{
+				if ((count++) % stride != first)
+					return false;
+				return this->FindAllMatchings(s);
+			}
+
+			nodeID_t n1 = NULL_NODE, n2 = NULL_NODE;
+			while (s.NextPair(&n1, &n2, n1, n2))
+			{
+				if (s.IsFeasiblePair(n1, n2))
+				{
+					VFState s1(s);
+					s1.AddPair(n1, n2);
+					if (ExplorePrefix(s1))
+					{
+						return true;
+					}
+				}
+			}
+			return false;
+		}
+
+		inline struct timeval& FirstSolutionTime()
+		{
+			return this->fist_solution_time;
+		}
+
+		inline std::vector<MatchingSolution>& Solutions()
+		{
+			return this->solutions;
+		}
+	};
+
+public:
+	/*
+	* @param shardIndex Shard explored by this engine, from 0 to shardCount-1
+	* @param prefixDepth Depth of the states splitting the search space
+	*/
+	ParallelMatchingEngineShard(unsigned short int numThreads,
+		bool storeSolutions=false,
+		short int cpu = -1,
+		uint32_t shardIndex = 0,
+		uint32_t shardCount = 1,
+		uint16_t prefixDepth = 1,
+		MatchingVisitor<VFState> *visit = NULL):
+		MatchingEngine<VFState>(visit, storeSolutions),
+		cpu(cpu),
+		numThreads(numThreads),
+		shardIndex(shardIndex),
+		shardCount(shardCount),
+		prefixDepth(prefixDepth),
+		pool(numThreads),
+		firstSolutionFound(false){}
+
+	~ParallelMatchingEngineShard(){}
+
+	/*
+	* @brief Visits all the matchings of the shard.
+	* @param [in] factory Functor returning an initial state, called once by each thread.
+	*/
+	template<typename StateFactory>
+	bool FindAllMatchings(StateFactory factory)
+	{
+		firstSolutionFound = false;
+		int current_cpu = cpu;
+		for (int16_t i = 0; i < numThreads; ++i)
+		{
+			pool[i] = std::thread( [this,i,factory]{ this->Run(i, factory); } );
+#ifndef WIN32
+			//If cpu is not -1 set the thread affinity starting from the cpu
+			if(current_cpu > -1)
+			{
+				SetAffinity(current_cpu, pool[i].native_handle());
+				current_cpu++;
+			}
+#endif
+		}
+
+		//Waiting for process thread
+		for (auto &th : pool) {
+			if (th.joinable()) {
+				th.join();
+			}
+		}
+
+		//Exiting
+		return true;
+	}
+
+	inline size_t GetThreadCount() const {
+		return pool.size();
+	}
+
+private:
+
+	template<typename StateFactory>
+	void Run(int16_t thread_id, StateFactory factory)
+	{
+		//Subtree k belongs to the shard k % shardCount and, inside the shard,
+		//to the thread (k / shardCount) % numThreads
+		uint64_t stride = (uint64_t)shardCount * numThreads;
+		uint64_t first = (uint64_t)thread_id * shardCount + shardIndex;
+		ShardWorker worker(stride, first, prefixDepth, storeSolutions, visit);
+
+		VFState s0 = factory();
+		worker.ExplorePrefix(s0);
+
+		size_t found = worker.GetSolutionsCount();
+		if (!found)
+			return;
+
+		solCount += found;
+		std::lock_guard<std::mutex> guard(solutionsMutex);
+		struct timeval& t = worker.FirstSolutionTime();
+		if (!firstSolutionFound || timercmp(&t, &fist_solution_time, <))
+		{
+			fist_solution_time = t;
+			firstSolutionFound = true;
+		}
+		if (storeSolutions)
+		{
+			std::vector<MatchingSolution>& sols = worker.Solutions();
+			solutions.insert(solutions.end(), sols.begin(), sols.end());
+		}
+	}
+
+#ifndef WIN32
+	void SetAffinity(int cpu, pthread_t handle)
+	{
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(cpu, &cpuset);
+		int rc = pthread_setaffinity_np(handle, sizeof(cpu_set_t), &cpuset);
+		if (rc != 0)
+		{
+			std::cerr << "Error calling pthread_setaffinity_np: " << rc << "\n";
+		}
+	}
+#endif
+
+};
+
+}
+
+#endif /* PARALLELMATCHINGENGINESHARD_HPP */
@@ -8,6 +8,17 @@
 /*
 * VF3P2
 * Parallel Matching Engine with local and global state stack (no look-free stack)
+*
+* The states at the levels of the search tree lower than the split depth, and the
+* states exceeding the local stack limit, are shared through the global stack.
+* Both thresholds are adapted at runtime:
+*  - the split depth never goes below the first level whose estimated number of states,
+*    computed from the observed branching factor of each level, is enough to feed
+*    all the workers;
+*  - when workers find the global stack empty the split depth grows and the local
+*    limit shrinks, so that more states are shared;
+*  - when the global stack is long the split depth goes back and the local limit grows,
+*    so that less states go through the lock.
 */
 #ifndef PARALLELMATCHINGTHREADPOOLWLS_HPP
 #define PARALLELMATCHINGTHREADPOOLWLS_HPP
@@ -28,16 +39,69 @@
 
 namespace vflib {
 
+/*
+* Split policy chosen by ParallelMatchingEngineWLS
+*/
+struct WLSPolicyStats
+{
+	uint16_t splitDepth;		//Current split depth
+	uint16_t localStackLimit;	//Current local stack limit
+	uint16_t maxSplitDepth;		//Deepest split depth used
+	uint64_t adaptations;		//Number of times the thresholds have been changed
+	uint64_t starvations;		//Number of times a worker found both its stacks empty
+};
+
 template<typename VFState>
 class ParallelMatchingEngineWLS
 		: public ParallelMatchingEngine<VFState>
 {
 private:
+	typedef ParallelMatchingEngine<VFState> Base;
+	using Base::numThreads;
+	using Base::globalStackSize;
+
+	static const uint32_t ADAPT_PERIOD = 1024;		//States processed by a worker between two adaptations
+	static const uint32_t STATES_PER_WORKER = 8;	//States at the split depth needed to feed a worker
+	static const uint32_t LONG_QUEUE_PER_WORKER = 32;
+	static const uint16_t MIN_LOCAL_STACK_LIMIT = 4;
+	static const uint16_t MAX_LOCAL_STACK_LIMIT = 4096;
+
+	/*
+	* States processed and generated at each level by a worker.
+	* The counters are written only by their worker and read by the one adapting the policy.
+	* Padded to avoid false sharing between workers.
+	*/
+	struct LevelCounters
+	{
+		std::vector<std::atomic<uint64_t> > expanded;
+		std::vector<std::atomic<uint64_t> > generated;
+		uint32_t sinceAdapt;
+		char pad[64];
+
+		LevelCounters(size_t levels): expanded(levels), generated(levels), sinceAdapt(0)
+		{
+			for (size_t i = 0; i < levels; i++)
+			{
+				expanded[i].store(0, std::memory_order_relaxed);
+				generated[i].store(0, std::memory_order_relaxed);
+			}
+		}
+	};
 
-    uint16_t ssrLimitLevelForGlobalStack; 					//all the states belonging to ssr levels leq the this limit are put inside the global stack
-	uint16_t localStackLimitSize;         					//limit size for the local stack. All the exceeding states are stored in the global stack
+	std::atomic<uint16_t> ssrLimitLevelForGlobalStack; 		//all the states belonging to ssr levels leq the this limit are put inside the global stack
+	std::atomic<uint16_t> localStackLimitSize;         		//limit size for the local stack. All the exceeding states are stored in the global stack
 	std::vector<std::vector<VFState*> >localStateStack; 	//Local stack address by thread-id (ids are assigned by the pool)
 
+	uint16_t initialSplitDepth;
+	uint16_t initialLocalStackLimit;
+	uint16_t levelCount;
+	std::vector<LevelCounters*> counters;	//One for each worker plus one for the states generated before starting the pool
+	std::mutex policyMutex;
+	std::atomic<uint64_t> starvations;
+	uint64_t lastStarvations;				//Protected by policyMutex
+	std::atomic<uint64_t> adaptations;
+	std::atomic<uint16_t> maxSplitDepth;
+
 public:
 	ParallelMatchingEngineWLS(unsigned short int numThreads,
         bool storeSolutions=false,
@@ -48,17 +112,146 @@ public:
 		ParallelMatchingEngine<VFState>(numThreads, storeSolutions, cpu, visit),
         ssrLimitLevelForGlobalStack(ssrLimitLevelForGlobalStack),
         localStackLimitSize(localStackLimitSize),
-        localStateStack(numThreads){}
+        localStateStack(numThreads),
+        initialSplitDepth(ssrLimitLevelForGlobalStack),
+        initialLocalStackLimit(localStackLimitSize),
+        levelCount(0),
+        starvations(0),
+        lastStarvations(0),
+        adaptations(0),
+        maxSplitDepth(ssrLimitLevelForGlobalStack){}
 
-	~ParallelMatchingEngineWLS(){}
+	~ParallelMatchingEngineWLS()
+	{
+		ReleaseCounters();
+	}
 
+	bool FindAllMatchings(VFState& s)
+	{
+		ReleaseCounters();
+		levelCount = s.GetGraph1()->NodeCount() + 1;
+		for (int i = 0; i <= numThreads; i++)
+		{
+			counters.push_back(new LevelCounters(levelCount));
+		}
+
+		ssrLimitLevelForGlobalStack.store(initialSplitDepth);
+		localStackLimitSize.store(initialLocalStackLimit);
+		maxSplitDepth.store(initialSplitDepth);
+		starvations.store(0);
+		lastStarvations = 0;
+		adaptations.store(0);
+
+		//The initial state is expanded before starting the pool
+		Increment(counters[numThreads]->expanded[s.CoreLen()]);
+		return Base::FindAllMatchings(s);
+	}
+
+	/*
+	* @brief Split policy in use at the end of the last search
+	*/
+	WLSPolicyStats GetPolicyStats() const
+	{
+		WLSPolicyStats stats;
+		stats.splitDepth = ssrLimitLevelForGlobalStack.load();
+		stats.localStackLimit = localStackLimitSize.load();
+		stats.maxSplitDepth = maxSplitDepth.load();
+		stats.adaptations = adaptations.load();
+		stats.starvations = starvations.load();
+		return stats;
+	}
 
 private:
 
+	void ReleaseCounters()
+	{
+		for (size_t i = 0; i < counters.size(); i++)
+		{
+			delete counters[i];
+		}
+		counters.clear();
+	}
+
+	static inline void Increment(std::atomic<uint64_t>& counter)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	/*
+	* Estimates the first level with enough states to feed all the workers,
+	* from the branching factor observed at each level.
+	*/
+	uint16_t EstimateFeedingDepth()
+	{
+		const double needed = (double)STATES_PER_WORKER * numThreads;
+		double states = 1;
+		for (uint16_t level = 0; level + 1 < levelCount; level++)
+		{
+			uint64_t expanded = 0, generated = 0;
+			for (size_t i = 0; i < counters.size(); i++)
+			{
+				expanded += counters[i]->expanded[level].load(std::memory_order_relaxed);
+				generated += counters[i]->generated[level + 1].load(std::memory_order_relaxed);
+			}
+			if (!expanded)
+				return level;
+
+			states *= (double)generated / expanded;
+			if (states >= needed)
+				return level + 1;
+		}
+		return levelCount - 1;
+	}
+
+	/*
+	* Updates the thresholds. Only one worker at time adapts the policy,
+	* the others go on with the current one.
+	*/
+	void Adapt()
+	{
+		std::unique_lock<std::mutex> lock(policyMutex, std::try_to_lock);
+		if (!lock.owns_lock())
+			return;
+
+		uint16_t depth = ssrLimitLevelForGlobalStack.load(std::memory_order_relaxed);
+		uint16_t limit = localStackLimitSize.load(std::memory_order_relaxed);
+		uint16_t feeding = EstimateFeedingDepth();
+		uint64_t starved = starvations.load(std::memory_order_relaxed);
+
+		uint16_t newDepth = depth < feeding ? feeding : depth;
+		uint16_t newLimit = limit;
+		if (starved != lastStarvations)
+		{
+			//Workers are waiting while states sit in the local stacks
+			if (newDepth + 1 < levelCount)
+				newDepth++;
+			newLimit = limit / 2 < MIN_LOCAL_STACK_LIMIT ? MIN_LOCAL_STACK_LIMIT : limit / 2;
+		}
+		else if (globalStackSize.load(std::memory_order_relaxed) > (size_t)LONG_QUEUE_PER_WORKER * numThreads)
+		{
+			//Enough shared states, sharing less reduces the contention on the global stack
+			if (newDepth > feeding)
+				newDepth--;
+			newLimit = limit * 2 > MAX_LOCAL_STACK_LIMIT ? MAX_LOCAL_STACK_LIMIT : limit * 2;
+		}
+		lastStarvations = starved;
+
+		if (newDepth != depth || newLimit != limit)
+		{
+			ssrLimitLevelForGlobalStack.store(newDepth, std::memory_order_relaxed);
+			localStackLimitSize.store(newLimit, std::memory_order_relaxed);
+			if (newDepth > maxSplitDepth.load(std::memory_order_relaxed))
+				maxSplitDepth.store(newDepth, std::memory_order_relaxed);
+			adaptations.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
 	void PutState(VFState* s, ThreadId thread_id) {
+		Increment(counters[Base::ArenaOf(thread_id)]->generated[s->CoreLen()]);
+
 		if(thread_id == NULL_THREAD || 
-			s->CoreLen() < ssrLimitLevelForGlobalStack || 
-			localStateStack[thread_id].size() > localStackLimitSize)
+			s->CoreLen() < ssrLimitLevelForGlobalStack.load(std::memory_order_relaxed) || 
+			localStateStack[thread_id].size() > localStackLimitSize.load(std::memory_order_relaxed))
 		{
 			ParallelMatchingEngine<VFState>::PutState(s, thread_id);
 		}
@@ -73,6 +266,13 @@ private:
 	bool GetState(VFState** res, ThreadId thread_id)
 	{
 		*res = NULL;
+		LevelCounters* c = counters[thread_id];
+		if (++c->sinceAdapt == ADAPT_PERIOD)
+		{
+			c->sinceAdapt = 0;
+			Adapt();
+		}
+
         //Getting from local stack firts
         if(localStateStack[thread_id].size())
         {
@@ -81,8 +281,15 @@ private:
         }
         else
         {
-			return ParallelMatchingEngine<VFState>::GetState(res, thread_id);
+			if (!globalStackSize.load(std::memory_order_relaxed))
+			{
+				starvations.fetch_add(1, std::memory_order_relaxed);
+				Adapt();
+			}
+			if (!ParallelMatchingEngine<VFState>::GetState(res, thread_id))
+				return false;
         }
+		Increment(c->expanded[(*res)->CoreLen()]);
 		return true;
 	}
 };
@@ -0,0 +1,267 @@
+/*
+ * ParallelMatchingEngineWS.hpp
+ */
+
+/*
+* VF3P3
+* Parallel Matching Engine with a lock-free work stealing deque for each worker.
+* The owner pushes and pops the states at the bottom of its deque, idle workers steal
+* from the top of the deque of a random victim, trying first the workers on the same
+* NUMA node.
+* Termination is detected by the atomic count of the outstanding states of the base engine,
+* that are the states generated and not yet processed.
+*/
+
+#ifndef PARALLELMATCHINGENGINEWS_HPP
+#define PARALLELMATCHINGENGINEWS_HPP
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "ARGraph.hpp"
+#include "ParallelMatchingEngine.hpp"
+#include "WorkStealingDeque.hpp"
+
+namespace vflib {
+
+template<typename VFState>
+class ParallelMatchingEngineWS
+		: public ParallelMatchingEngine<VFState>
+{
+private:
+	typedef ParallelMatchingEngine<VFState> Base;
+	using Base::numThreads;
+	using Base::pendingStates;
+	using Base::workerCycles;
+	using Base::stateAllocator;
+	using Base::workerNode;
+
+	/*
+	* Data owned by each worker. Padded to avoid false sharing between workers.
+	*/
+	struct Worker
+	{
+		WorkStealingDeque<VFState*> deque;
+		std::vector<VFState*> children;	//States generated by the last expansion
+		uint64_t seed;					//Seed for the choice of the victim
+		std::vector<uint16_t> nearVictims;	//Other workers on the same NUMA node
+		char pad[WS_CACHE_LINE_SIZE];
+	};
+
+	std::vector<Worker*> workers;
+	uint16_t nextSeedWorker;			//Round robin target for the initial states
+
+public:
+	ParallelMatchingEngineWS(unsigned short int numThreads,
+		bool storeSolutions=false,
+		short int cpu = -1,
+		MatchingVisitor<VFState> *visit = NULL):
+		ParallelMatchingEngine<VFState>(numThreads, storeSolutions, cpu, visit),
+		workers(numThreads),
+		nextSeedWorker(0)
+	{
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			workers[i] = new Worker();
+			workers[i]->seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+		}
+	}
+
+	~ParallelMatchingEngineWS()
+	{
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			delete workers[i];
+		}
+	}
+
+private:
+
+	inline uint32_t NextVictim(Worker* w)
+	{
+		//xorshift64
+		w->seed ^= w->seed << 13;
+		w->seed ^= w->seed >> 7;
+		w->seed ^= w->seed << 17;
+		return (uint32_t)(w->seed % numThreads);
+	}
+
+	inline uint32_t NextNearVictim(Worker* w)
+	{
+		w->seed ^= w->seed << 13;
+		w->seed ^= w->seed >> 7;
+		w->seed ^= w->seed << 17;
+		return w->nearVictims[w->seed % w->nearVictims.size()];
+	}
+
+	void FindNearVictims(ThreadId thread_id)
+	{
+		std::vector<uint16_t>& near = workers[thread_id]->nearVictims;
+		near.clear();
+		for (int16_t i = 0; i < numThreads; i++)
+		{
+			if (i != thread_id && workerNode[i] == workerNode[thread_id])
+				near.push_back(i);
+		}
+	}
+
+	/*
+	* Expands the state and stores its children in the children vector of the worker.
+	* Goal states are handled by the base engine.
+	*/
+	inline void ExpandState(VFState *s, ThreadId thread_id)
+	{
+		if (s->IsGoal() || s->IsDead())
+		{
+			Base::ProcessState(s, thread_id);
+			return;
+		}
+
+		std::vector<VFState*>& children = workers[thread_id]->children;
+		nodeID_t n1 = NULL_NODE, n2 = NULL_NODE;
+		while (!Base::IsCancelled() && s->NextPair(&n1, &n2, n1, n2))
+		{
+			if (s->IsFeasiblePair(n1, n2))
+			{
+				VFState* s1 = stateAllocator.New(*s, thread_id);
+				s1->AddPair(n1, n2);
+				children.push_back(s1);
+			}
+		}
+	}
+
+	/*
+	* Publishes the children of the processed state.
+	* The count of the outstanding states is updated once for the whole expansion,
+	* before the children become visible to the thieves.
+	*/
+	inline void PublishChildren(ThreadId thread_id)
+	{
+		Worker* w = workers[thread_id];
+		size_t count = w->children.size();
+		if (!count)
+		{
+			Base::StateDone();
+			return;
+		}
+
+		if (count > 1)
+		{
+			pendingStates.fetch_add(count - 1, std::memory_order_acq_rel);
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			w->deque.Push(w->children[i]);
+		}
+		w->children.clear();
+
+		if (count > 1)
+		{
+			Base::WakeWorkers(false);
+		}
+	}
+
+	void Run(ThreadId thread_id)
+	{
+		VFState* s = NULL;
+		FindNearVictims(thread_id);
+
+		uint64_t idle_start = ReadCycleCounter();
+		while (GetState(&s, thread_id))
+		{
+			uint64_t busy_start = ReadCycleCounter();
+			workerCycles[thread_id].idle += busy_start - idle_start;
+
+			//After a stop the queued states are only drained
+			if (!Base::IsCancelled())
+			{
+				Base::BindToWorkerNode(s, thread_id);
+				ExpandState(s, thread_id);
+			}
+			stateAllocator.Delete(s, thread_id);
+			PublishChildren(thread_id);
+
+			idle_start = ReadCycleCounter();
+			workerCycles[thread_id].busy += idle_start - busy_start;
+		}
+		workerCycles[thread_id].idle += ReadCycleCounter() - idle_start;
+	}
+
+	bool IsWorkAvailable()
+	{
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			if (!workers[i]->deque.Empty())
+				return true;
+		}
+		return false;
+	}
+
+	/*
+	* Used for the states generated before starting the pool (thread_id == NULL_THREAD).
+	* They are spread round robin over the deques.
+	*/
+	void PutState(VFState* s, ThreadId thread_id)
+	{
+		if (thread_id == NULL_THREAD)
+		{
+			thread_id = nextSeedWorker;
+			nextSeedWorker = (nextSeedWorker + 1) % numThreads;
+		}
+		workers[thread_id]->deque.Push(s);
+	}
+
+	bool GetState(VFState** res, ThreadId thread_id)
+	{
+		Worker* w = workers[thread_id];
+		IdleBackoff backoff;
+		*res = NULL;
+
+		if (w->deque.Pop(*res))
+		{
+			return true;
+		}
+
+		const int16_t nearCount = (int16_t)w->nearVictims.size();
+		while (true)
+		{
+			for (int16_t attempt = 0; attempt < 2 * nearCount; attempt++)
+			{
+				if (workers[NextNearVictim(w)]->deque.Steal(*res))
+				{
+					return true;
+				}
+			}
+
+			//Remote victims, only if some worker is on another node
+			for (int16_t attempt = 0; nearCount + 1 < numThreads && attempt < 2 * numThreads; attempt++)
+			{
+				uint32_t victim = NextVictim(w);
+				if (victim != thread_id && workers[victim]->deque.Steal(*res))
+				{
+					return true;
+				}
+			}
+
+			//No outstanding states means that nobody can generate new ones
+			if (Base::IsSearchOver())
+			{
+				*res = NULL;
+				return false;
+			}
+
+			if (backoff.Wait())
+			{
+				Base::ParkWorker();
+				backoff.Reset();
+			}
+		}
+	}
+};
+
+}
+
+#endif /* PARALLELMATCHINGENGINEWS_HPP */
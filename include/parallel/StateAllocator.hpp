@@ -0,0 +1,171 @@
+/*
+ * StateAllocator.hpp
+ */
+
+/*
+* Per thread slab allocator for the states generated by the parallel engines.
+* Each state is stored in a fixed size record holding both the state object and,
+* right after it, the block with its arrays. The records are carved from large slabs
+* and recycled through a free list owned by each thread, so that once the slabs
+* are warm the generation and the deletion of a state do not call the heap.
+*
+* The VFState must provide:
+*  - size_t StorageSize() const, the size of the block with its arrays;
+*  - VFState(const VFState& state, void* storage), a copy constructor building
+*    the copy in a block of StorageSize() bytes that it does not own.
+*/
+
+#ifndef STATEALLOCATOR_HPP
+#define STATEALLOCATOR_HPP
+
+#include <new>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace vflib {
+
+template<typename VFState>
+class StateAllocator
+{
+private:
+	static const size_t RECORD_ALIGNMENT = 64;		//Records never share a cache line
+	static const size_t SLAB_MIN_RECORDS = 64;
+	static const size_t SLAB_MIN_SIZE = 1 << 20;
+
+	/*
+	* Free records are linked through their first bytes
+	*/
+	struct FreeRecord
+	{
+		FreeRecord* next;
+	};
+
+	/*
+	* Arena of a single thread. Padded to avoid false sharing between threads.
+	*/
+	struct Arena
+	{
+		FreeRecord* freeList;
+		char* slabCursor;
+		char* slabEnd;
+		std::vector<char*> slabs;
+		char pad[RECORD_ALIGNMENT];
+
+		Arena(): freeList(NULL), slabCursor(NULL), slabEnd(NULL) {}
+	};
+
+	size_t stateOffset;		//Offset of the storage block inside the record
+	size_t recordSize;
+	size_t slabSize;
+	std::vector<Arena*> arenas;
+
+	static inline size_t AlignUp(size_t size, size_t alignment)
+	{
+		return (size + alignment - 1) / alignment * alignment;
+	}
+
+	char* AllocateRecord(Arena* arena)
+	{
+		if (arena->freeList)
+		{
+			char* record = (char*)arena->freeList;
+			arena->freeList = arena->freeList->next;
+			return record;
+		}
+
+		if (arena->slabCursor == arena->slabEnd)
+		{
+			char* slab = (char*)::operator new(slabSize + RECORD_ALIGNMENT);
+			arena->slabs.push_back(slab);
+			arena->slabCursor = (char*)AlignUp((size_t)slab, RECORD_ALIGNMENT);
+			arena->slabEnd = arena->slabCursor + slabSize;
+		}
+
+		char* record = arena->slabCursor;
+		arena->slabCursor += recordSize;
+		return record;
+	}
+
+	void ReleaseSlabs()
+	{
+		for (size_t i = 0; i < arenas.size(); i++)
+		{
+			for (size_t j = 0; j < arenas[i]->slabs.size(); j++)
+			{
+				::operator delete(arenas[i]->slabs[j]);
+			}
+			delete arenas[i];
+			arenas[i] = new Arena();
+		}
+	}
+
+public:
+	/*
+	* @param arenaCount Number of threads that can use the allocator
+	*/
+	StateAllocator(size_t arenaCount): stateOffset(0), recordSize(0), slabSize(0), arenas(arenaCount)
+	{
+		for (size_t i = 0; i < arenas.size(); i++)
+		{
+			arenas[i] = new Arena();
+		}
+	}
+
+	~StateAllocator()
+	{
+		ReleaseSlabs();
+		for (size_t i = 0; i < arenas.size(); i++)
+		{
+			delete arenas[i];
+		}
+	}
+
+	/*
+	* @brief Sets the size of the records from a prototype of the states to allocate.
+	* @note All the records must have been released. Slabs of a different size are freed.
+	*/
+	void Init(const VFState& prototype)
+	{
+		size_t offset = AlignUp(sizeof(VFState), sizeof(void*));
+		size_t size = AlignUp(offset + prototype.StorageSize(), RECORD_ALIGNMENT);
+		if (size == recordSize)
+		{
+			return;
+		}
+
+		ReleaseSlabs();
+		stateOffset = offset;
+		recordSize = size;
+		slabSize = recordSize * SLAB_MIN_RECORDS;
+		if (slabSize < SLAB_MIN_SIZE)
+		{
+			slabSize = SLAB_MIN_SIZE / recordSize * recordSize;
+		}
+	}
+
+	/*
+	* @brief Builds a copy of the state in a record of the arena of the thread.
+	*/
+	inline VFState* New(const VFState& state, size_t arena)
+	{
+		char* record = AllocateRecord(arenas[arena]);
+		return new (record) VFState(state, record + stateOffset);
+	}
+
+	/*
+	* @brief Destroys a state and gives its record back to the arena of the calling thread.
+	* The state can have been allocated by any thread.
+	*/
+	inline void Delete(VFState* s, size_t arena)
+	{
+		s->~VFState();
+		FreeRecord* record = (FreeRecord*)s;
+		record->next = arenas[arena]->freeList;
+		arenas[arena]->freeList = record;
+	}
+};
+
+}
+
+#endif /* STATEALLOCATOR_HPP */
@@ -0,0 +1,145 @@
+/*
+ * VF3MatchPlan.hpp
+ */
+
+/*
+* Read-only data driving the exploration of the parallel states.
+* It depends only on the pattern, on the node order and on the node classes,
+* thus it is computed once by the initial state and shared by all its copies.
+*/
+
+#ifndef VF3_MATCH_PLAN_HPP
+#define VF3_MATCH_PLAN_HPP
+
+#include <vector>
+#include "ARGraph.hpp"
+
+typedef unsigned char node_dir_t;
+#define NODE_DIR_NONE 0
+#define NODE_DIR_IN	1
+#define NODE_DIR_OUT 2
+#define NODE_DIR_BOTH 3
+
+namespace vflib
+{
+
+class VF3MatchPlan
+{
+public:
+  uint32_t n1, n2;          //Size of each graph
+  nodeID_t *order;          //Order to traverse node on the first graph
+  uint32_t *class_1;        //Classes for nodes of the first graph
+  uint32_t *class_2;        //Classes for nodes of the second graph
+  uint32_t classes_count;   //Number of classes
+
+  std::vector<nodeID_t> predecessors;  //Previous node in the ordered sequence connected to a node
+  std::vector<node_dir_t> dir;         //Direction of the edge connecting a node to its predecessor
+  std::vector<nodeID_t> depth;         //Position of each node in the order
+
+  template <typename Node1, typename Edge1>
+  VF3MatchPlan(ARGraph<Node1, Edge1> *g1, uint32_t n2,
+    uint32_t* class_1, uint32_t* class_2, uint32_t nclass, nodeID_t* order);
+
+private:
+  template <typename Node1, typename Edge1>
+  void ComputeFirstGraphTraversing(ARGraph<Node1, Edge1> *g1);
+};
+
+
+template <typename Node1, typename Edge1>
+VF3MatchPlan::VF3MatchPlan(ARGraph<Node1, Edge1> *g1, uint32_t n2,
+    uint32_t* class_1, uint32_t* class_2, uint32_t nclass, nodeID_t* order):
+  n1(g1->NodeCount()), n2(n2), order(order),
+  class_1(class_1), class_2(class_2), classes_count(nclass),
+  predecessors(g1->NodeCount(), NULL_NODE),
+  dir(g1->NodeCount(), NODE_DIR_NONE),
+  depth(g1->NodeCount())
+{
+  for(nodeID_t i = 0; i < n1; i++)
+    depth[order[i]] = i;
+
+  ComputeFirstGraphTraversing(g1);
+}
+
+//Provare ad avere in1 ed ou1 predeterminati, senza doverlo calcolare ad ogni iterazione
+//La loro dimensione ad ogni livello dell'albero di ricerca e' predeterminato
+//In questo modo mi basta conoscere solo l'ordine di scelta e la dimensione di in1 ed out1
+template <typename Node1, typename Edge1>
+void VF3MatchPlan::ComputeFirstGraphTraversing(ARGraph<Node1, Edge1> *g1){
+  //The algorithm start with the node with the maximum degree
+  nodeID_t depth, i;
+  nodeID_t node;	//Current Node
+  bool* inserted = new bool[n1];
+  bool *in, *out; //Internal Terminal Set used for updating the size of
+  in = new bool[n1];
+  out = new bool[n1];
+
+  for(i = 0; i < n1; i++)
+    {
+    in[i] = false;
+    out[i] = false;
+    inserted[i] = false;
+    }
+
+  /* Following the imposed node order */
+  for(depth = 0; depth < n1; depth++)
+    {
+    node = order[depth];
+    inserted[node] = true;
+
+    //Inserting the node
+    //Terminal set sizes depends on the depth
+    // < depth non sono nell'insieme
+    // >= depth sono nell'insieme
+    if (!in[node])
+      in[node]=true;
+
+    if (!out[node])
+      out[node]=true;
+
+    //Updating terminal sets
+    uint32_t i;
+    nodeID_t other;
+    for(i=0; i<g1->InEdgeCount(node); i++)
+      {
+      other=g1->GetInEdge(node, i);
+      if (!in[other])
+        {
+        in[other]=true;
+        if(!inserted[other])
+        {
+          if(predecessors[other] == NULL_NODE)
+          {
+            dir[other] = NODE_DIR_IN;
+            predecessors[other] = node;
+          }
+        }
+        }
+      }
+
+    for(i=0; i<g1->OutEdgeCount(node); i++)
+      {
+      other=g1->GetOutEdge(node, i);
+      if (!out[other])
+        {
+        out[other]=true;
+        if(!inserted[other])
+        {
+          if(predecessors[other] == NULL_NODE)
+          {
+            predecessors[other] = node;
+            dir[other] = NODE_DIR_OUT;
+          }
+        }
+        }
+      }
+    }
+
+  delete [] in;
+  delete [] out;
+  delete [] inserted;
+}
+
+}
+
+#endif
@@ -0,0 +1,540 @@
+/*
+ * VF3ParallelCompactSubState.hpp
+ */
+
+#ifndef VF3_PARALLEL_COMPACT_SUB_STATE_HPP
+#define VF3_PARALLEL_COMPACT_SUB_STATE_HPP
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "ARGraph.hpp"
+#include "CandidateFilter.hpp"
+#include "VF3MatchPlan.hpp"
+
+namespace vflib
+{
+
+/*----------------------------------------------------------
+ * class VF3ParallelCompactSubState
+ * A representation of the SSR current state storing only
+ * the path of the search, that is the target node matched
+ * at each depth of the order of the plan.
+ * The memory of a queued state is O(n1) instead of O(n1 + n2).
+ *
+ * The core set of the target graph is rebuilt in a scratch
+ * array owned by the thread, when the thread starts working
+ * on the state. Each version of a state has a unique stamp,
+ * so the scratch is rebuilt only when the thread switches to
+ * a different state.
+ * As for VF3ParallelSubState, the copies share the plan of the
+ * initial state and must not outlive it.
+ ---------------------------------------------------------*/
+template <typename Node1, typename Node2,
+typename Edge1, typename Edge2,
+typename NodeComparisonFunctor = EqualityComparator<Node1, Node2>,
+typename EdgeComparisonFunctor = EqualityComparator<Edge1, Edge2> >
+class VF3ParallelCompactSubState
+{
+private:
+  /*
+  * Core set of the target graph of the state bound to the thread
+  */
+  struct Scratch
+  {
+    std::vector<nodeID_t> core_2;
+    std::vector<nodeID_t> bound;  //Target nodes set in core_2
+    uint64_t stamp;               //Stamp of the bound state
+
+    Scratch():stamp(0){}
+  };
+
+  static thread_local Scratch scratch;
+  static std::atomic<uint64_t> thread_stamp_count;
+
+  //Comparison functors for nodes and edges
+  NodeComparisonFunctor nf;
+  EdgeComparisonFunctor ef;
+
+  //Graphs to analyze
+  ARGraph<Node1, Edge1> *g1;
+  ARGraph<Node2, Edge2> *g2;
+
+  //Size of each graph
+  int n1, n2;
+
+  VF3MatchPlan *plan;  //Shared read-only data
+  bool owns_plan;
+
+  int core_len;       //Current length of the core set
+  uint64_t stamp;     //Unique id of this version of the state
+
+  //Target node matched at each depth, stored in a block of StorageSize() bytes,
+  //either owned by the state or provided by an allocator
+  nodeID_t* path;
+  bool owns_storage;
+
+  int last_candidate_index;
+
+  static uint64_t NewStamp();
+  inline nodeID_t Core1(nodeID_t node) const;
+  nodeID_t* BindScratch();
+  void CopyFrom(const VF3ParallelCompactSubState &state);
+
+public:
+  VF3ParallelCompactSubState():plan(NULL), owns_plan(false), owns_storage(false){}
+  VF3ParallelCompactSubState(ARGraph<Node1, Edge1> *g1, ARGraph<Node2, Edge2> *g2,
+		  uint32_t* class_1, uint32_t* class_2, uint32_t nclass,
+                nodeID_t* order = NULL);
+  VF3ParallelCompactSubState(const VF3ParallelCompactSubState &state);
+  VF3ParallelCompactSubState(const VF3ParallelCompactSubState &state, void* storage);
+  ~VF3ParallelCompactSubState()
+  {
+    if(owns_storage)
+      delete [] path;
+    if(owns_plan)
+      delete plan;
+  }
+  VF3ParallelCompactSubState& operator=(const VF3ParallelCompactSubState& state);
+  ARGraph<Node1, Edge1> *GetGraph1() { return g1; }
+  ARGraph<Node2, Edge2> *GetGraph2() { return g2; }
+  //Replaces the target graph with an identical copy, e.g. a replica local to a NUMA node
+  void SetGraph2(ARGraph<Node2, Edge2> *g) { assert(g->NodeCount() == (uint32_t)n2); g2 = g; }
+  bool NextPair(nodeID_t *pn1, nodeID_t *pn2, nodeID_t prev_n1=NULL_NODE, nodeID_t prev_n2=NULL_NODE);
+  bool IsFeasiblePair(nodeID_t n1, nodeID_t n2);
+  void AddPair(nodeID_t n1, nodeID_t n2);
+  void RemovePair(nodeID_t n1, nodeID_t n2);
+  inline bool IsGoal() { return core_len==n1; };
+  inline bool IsDead(){return false; };
+
+  int CoreLen() { return core_len; }
+
+  inline int GetCandidateCursor() const { return last_candidate_index; }
+  inline void SetCandidateCursor(int cursor) { last_candidate_index = cursor; }
+
+  /*
+  * Size in bytes of the block holding the path of the state.
+  */
+  inline size_t StorageSize() const
+  {
+    return n1 * sizeof(nodeID_t);
+  }
+
+  inline void GetCoreSet(std::vector<std::pair<nodeID_t, nodeID_t> >& core)
+	{
+		int i;
+		core.resize(n1);
+		for (i = 0; i < core_len; i++)
+		{
+			nodeID_t node = plan->order[i];
+			core[node] = std::pair<nodeID_t, nodeID_t>(node, path[i]);
+		}
+	}
+};
+
+template <typename Node1, typename Node2, typename Edge1, typename Edge2,
+typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+thread_local typename VF3ParallelCompactSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>::Scratch
+	VF3ParallelCompactSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>::scratch;
+
+template <typename Node1, typename Node2, typename Edge1, typename Edge2,
+typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+std::atomic<uint64_t>
+	VF3ParallelCompactSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>::thread_stamp_count(0);
+
+
+/*----------------------------------------------------------
+ * Returns a stamp never returned before by any thread.
+ * The high bits identify the thread, so the global counter
+ * is touched only once for each thread.
+ ---------------------------------------------------------*/
+template <typename Node1, typename Node2,
+typename Edge1, typename Edge2,
+typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+uint64_t VF3ParallelCompactSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>
+	::NewStamp()
+{
+  static thread_local uint64_t thread_base = (thread_stamp_count.fetch_add(1) + 1) << 40;
+  static thread_local uint64_t count = 0;
+  return thread_base | ++count;
+}
+
+template <typename Node1, typename Node2,
+typename Edge1, typename Edge2,
+typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+inline nodeID_t VF3ParallelCompactSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>
+	::Core1(nodeID_t node) const
+{
+  nodeID_t d = plan->depth[node];
+  return d < (nodeID_t)core_len ? path[d] : NULL_NODE;
+}
+
+/*----------------------------------------------------------
+ * Binds the state to the scratch of the calling thread,
+ * rebuilding the core set of the target graph if the scratch
+ * was bound to another state.
+ * Returns the core set of the target graph.
+ ---------------------------------------------------------*/
+template <typename Node1, typename Node2,
+typename Edge1, typename Edge2,
+typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+nodeID_t* VF3ParallelCompactSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>
+	::BindScratch()
+{
+  Scratch& sc = scratch;
+  if(sc.stamp == stamp)
+    return sc.core_2.data();
+
+  if(sc.core_2.size() < (size_t)n2)
+  {
+    sc.core_2.assign(n2, NULL_NODE);
+  }
+  else
+  {
+    for(size_t i = 0; i < sc.bound.size(); i++)
+      sc.core_2[sc.bound[i]] = NULL_NODE;
+  }
+
+  sc.bound.assign(path, path + core_len);
+  for(int i = 0; i < core_len; i++)
+    sc.core_2[path[i]] = plan->order[i];
+
+  sc.stamp = stamp;
+  return sc.core_2.data();
+}
+
+
+/*----------------------------------------------------------
+ * VF3ParallelCompactSubState::VF3ParallelCompactSubState(g1, g2)
+ * Constructor. Makes an empty state.
+ ---------------------------------------------------------*/
+template <typename Node1, typename Node2,
+typename Edge1, typename Edge2,
+typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+VF3ParallelCompactSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>
+	::VF3ParallelCompactSubState(ARGraph<Node1, Edge1> *ag1, ARGraph<Node2, Edge2> *ag2,
+			uint32_t* class_1, uint32_t* class_2, uint32_t nclass, nodeID_t* order)
+{
+  assert(class_1!=NULL && class_2!=NULL);
+
+  g1=ag1;
+  g2=ag2;
+  n1=g1->NodeCount();
+  n2=g2->NodeCount();
+  last_candidate_index = 0;
+  core_len=0;
+  stamp=NewStamp();
+
+  plan = new VF3MatchPlan(g1, n2, class_1, class_2, nclass, order);
+  owns_plan = true;
+
+  path = new nodeID_t[n1];
+  owns_storage = true;
+}
+
+
+/*----------------------------------------------------------
+ * VF3ParallelCompactSubState::CopyFrom(state)
+ * Copies the scalar members of a state and shares its plan.
+ ---------------------------------------------------------*/
+template <typename Node1, typename Node2,
+typename Edge1, typename Edge2,
+typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+void VF3ParallelCompactSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>
+	::CopyFrom(const VF3ParallelCompactSubState &state)
+{
+  g1=state.g1;
+  g2=state.g2;
+  n1=state.n1;
+  n2=state.n2;
+
+  plan=state.plan;
+  owns_plan=false;
+  last_candidate_index = state.last_candidate_index;
+  core_len=state.core_len;
+  stamp=NewStamp();
+}
+
+
+/*----------------------------------------------------------
+ * VF3ParallelCompactSubState::VF3ParallelCompactSubState(state)
+ * Copy constructor.
+ ---------------------------------------------------------*/
+template <typename Node1, typename Node2,
+typename Edge1, typename Edge2,
+typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+VF3ParallelCompactSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>::
+	VF3ParallelCompactSubState(const VF3ParallelCompactSubState &state):
+	owns_plan(false), owns_storage(false)
+{
+  *this = state;
+}
+
+
+/*----------------------------------------------------------
+ * VF3ParallelCompactSubState::VF3ParallelCompactSubState(state, storage)
+ * Copy constructor building the copy in a block provided
+ * by the caller, which must be at least StorageSize() bytes.
+ * Only the first core_len entries of the path are copied.
+ ---------------------------------------------------------*/
+template <typename Node1, typename Node2,
+typename Edge1, typename Edge2,
+typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+VF3ParallelCompactSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>::
+	VF3ParallelCompactSubState(const VF3ParallelCompactSubState &state, void* storage)
+{
+  CopyFrom(state);
+  path = (nodeID_t*)storage;
+  owns_storage = false;
+  std::memcpy(path, state.path, core_len * sizeof(nodeID_t));
+}
+
+
+template <typename Node1, typename Node2,
+typename Edge1, typename Edge2,
+typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+VF3ParallelCompactSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>&
+	VF3ParallelCompactSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>
+	::operator=(const VF3ParallelCompactSubState &state)
+{
+	if(this != &state)
+	{
+	  if(owns_storage)
+	    delete [] path;
+	  if(owns_plan)
+	    delete plan;
+
+	  CopyFrom(state);
+	  path = new nodeID_t[n1];
+	  owns_storage = true;
+	  std::memcpy(path, state.path, core_len * sizeof(nodeID_t));
+	}
+	return *this;
+}
+
+
+template <typename Node1, typename Node2,
+typename Edge1, typename Edge2,
+typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+bool VF3ParallelCompactSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>
+	::NextPair(nodeID_t *pn1, nodeID_t *pn2,nodeID_t prev_n1, nodeID_t prev_n2)
+{
+  nodeID_t curr_n1;
+  nodeID_t pred_pair; //Node mapped with the predecessor
+  nodeID_t pred_set_size = 0;
+  const nodeID_t *pred_set = NULL;
+  int c = 0;
+  pred_pair = NULL_NODE;
+  const uint32_t *class_2 = plan->class_2;
+  const nodeID_t *core_2 = BindScratch();
+
+  curr_n1 = plan->order[core_len];
+  c = plan->class_1[curr_n1];
+
+  if(plan->predecessors[curr_n1] != NULL_NODE)
+    {
+    if (prev_n2 == NULL_NODE)
+      last_candidate_index = 0;
+    else{
+      last_candidate_index++; //Next Element
+    }
+
+    pred_pair = Core1(plan->predecessors[curr_n1]);
+    switch (plan->dir[curr_n1])
+      {
+        case NODE_DIR_IN:
+        if(g2->HasClassIndex())
+          pred_set = g2->GetInEdgeSetOfClass(pred_pair, c, pred_set_size);
+        else
+          {
+          pred_set_size = g2->InEdgeCount(pred_pair);
+          pred_set = g2->GetInEdgeSet(pred_pair);
+          }
+
+        break;
+
+        case NODE_DIR_OUT:
+        if(g2->HasClassIndex())
+          pred_set = g2->GetOutEdgeSetOfClass(pred_pair, c, pred_set_size);
+        else
+          {
+          pred_set_size = g2->OutEdgeCount(pred_pair);
+          pred_set = g2->GetOutEdgeSet(pred_pair);
+          }
+
+        break;
+      }
+
+    //With the slices sorted by degree the candidates too small for curr_n1 are a suffix
+    if(g2->HasClassIndex() && g2->ClassIndexByDegree())
+      pred_set_size = g2->DegreeCutoff(pred_set, pred_set_size, g1->EdgeCount(curr_n1));
+
+    last_candidate_index = NextCandidate(pred_set, last_candidate_index, pred_set_size,
+      core_2, class_2, c);
+    if(last_candidate_index >= pred_set_size)
+      return false;
+    prev_n2 = pred_set[last_candidate_index];
+
+    }
+  else
+    {
+    if(prev_n2 == NULL_NODE)
+      prev_n2 = 0;
+    else
+      prev_n2++;
+
+    prev_n2 = NextFreeCandidate(prev_n2, n2, core_2, class_2, c);
+    }
+
+  if (prev_n2 < n2) {
+    *pn1 = curr_n1;
+    *pn2 = prev_n2;
+    return true;
+  }
+
+  return false;
+}
+
+
+/*---------------------------------------------------------------
+ * bool VF3ParallelCompactSubState::IsFeasiblePair(node1, node2)
+ * Returns true if (node1, node2) can be added to the state
+ * See VF3ParallelSubState::IsFeasiblePair
+ --------------------------------------------------------------*/
+template <typename Node1, typename Node2,
+typename Edge1, typename Edge2,
+typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+bool VF3ParallelCompactSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>::IsFeasiblePair(nodeID_t node1, nodeID_t node2)
+{
+  const nodeID_t *core_2 = BindScratch();
+
+  assert(node1<n1);
+  assert(node2<n2);
+  assert(Core1(node1)==NULL_NODE);
+  assert(core_2[node2]==NULL_NODE);
+
+  if(!TrivialComparison<Node1, Node2, NodeComparisonFunctor>::value &&
+     !nf(g1->GetNodeAttr(node1), g2->GetNodeAttr(node2)))
+    return false;
+
+  if(g1->InEdgeCount(node1) > g2->InEdgeCount(node2)
+    || g1->OutEdgeCount(node1) > g2->OutEdgeCount(node2))
+    return false;
+
+  int i, other1, other2;
+  Edge1 eattr1;
+  Edge2 eattr2;
+  //Without attributes to compare the edges are only looked up
+  const bool edge_attr = !TrivialComparison<Edge1, Edge2, EdgeComparisonFunctor>::value;
+
+  // Check the 'out' edges of node1
+  for(i=0; i<g1->OutEdgeCount(node1); i++)
+    { other1 = edge_attr ? g1->GetOutEdge(node1, i, eattr1) : g1->GetOutEdge(node1, i);
+      other2=Core1(other1);
+      if (other2 != NULL_NODE)
+        {
+          if (edge_attr ? (!g2->HasEdge(node2, other2, eattr2) || !ef(eattr1, eattr2))
+                        : !g2->HasEdge(node2, other2))
+            return false;
+        }
+    }
+
+  // Check the 'in' edges of node1
+  for(i=0; i<g1->InEdgeCount(node1); i++)
+    { other1 = edge_attr ? g1->GetInEdge(node1, i, eattr1) : g1->GetInEdge(node1, i);
+      other2=Core1(other1);
+      if (other2 != NULL_NODE)
+        {
+          if (edge_attr ? (!g2->HasEdge(other2, node2, eattr2) || !ef(eattr1, eattr2))
+                        : !g2->HasEdge(other2, node2))
+            return false;
+        }
+    }
+
+  // Check the 'out' edges of node2
+  for(i=0; i<g2->OutEdgeCount(node2); i++)
+    { other2=g2->GetOutEdge(node2, i);
+      if (core_2[other2]!=NULL_NODE)
+        { other1=core_2[other2];
+          if (!g1->HasEdge(node1, other1))
+            return false;
+        }
+   }
+
+  // Check the 'in' edges of node2
+  for(i=0; i<g2->InEdgeCount(node2); i++)
+    { other2=g2->GetInEdge(node2, i);
+      if (core_2[other2] != NULL_NODE)
+        { other1=core_2[other2];
+          if (!g1->HasEdge(other1, node1))
+            return false;
+        }
+   }
+
+  return true;
+}
+
+
+/*--------------------------------------------------------------
+ * void VF3ParallelCompactSubState::AddPair(node1, node2)
+ * Appends a pair to the path of the state.
+ * Precondition: the pair must be feasible and node1 must be
+ * the next node in the order
+ -------------------------------------------------------------*/
+template <typename Node1, typename Node2,
+typename Edge1, typename Edge2,
+typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+void VF3ParallelCompactSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,
+EdgeComparisonFunctor>::AddPair(nodeID_t node1, nodeID_t node2)
+{
+  assert(node1<n1);
+  assert(node2<n2);
+  assert(core_len<n1);
+  assert(plan->order[core_len] == node1);
+  assert(plan->class_1[node1] == plan->class_2[node2]);
+
+  path[core_len++] = node2;
+
+  //A scratch bound to this state follows it, any other scratch is invalidated by the new stamp
+  Scratch& sc = scratch;
+  uint64_t new_stamp = NewStamp();
+  if(sc.stamp == stamp)
+  {
+    sc.core_2[node2] = node1;
+    sc.bound.push_back(node2);
+    sc.stamp = new_stamp;
+  }
+  stamp = new_stamp;
+}
+
+
+/*--------------------------------------------------------------
+ * void VF3ParallelCompactSubState::RemovePair(node1, node2)
+ * Removes from the path the last pair added by AddPair.
+ -------------------------------------------------------------*/
+template <typename Node1, typename Node2,
+typename Edge1, typename Edge2,
+typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+void VF3ParallelCompactSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,
+EdgeComparisonFunctor>::RemovePair(nodeID_t node1, nodeID_t node2)
+{
+  assert(core_len>0);
+  assert(plan->order[core_len-1] == node1);
+  assert(path[core_len-1] == node2);
+
+  core_len--;
+
+  Scratch& sc = scratch;
+  uint64_t new_stamp = NewStamp();
+  if(sc.stamp == stamp)
+  {
+    sc.core_2[node2] = NULL_NODE;
+    sc.bound.pop_back();
+    sc.stamp = new_stamp;
+  }
+  stamp = new_stamp;
+}
+
+}
+#endif
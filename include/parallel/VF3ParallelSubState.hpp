@@ -13,12 +13,8 @@
 #include <iostream>
 #include <vector>
 #include "ARGraph.hpp"
-
-typedef unsigned char node_dir_t;
-#define NODE_DIR_NONE 0
-#define NODE_DIR_IN	1
-#define NODE_DIR_OUT 2
-#define NODE_DIR_BOTH 3
+#include "CandidateFilter.hpp"
+#include "VF3MatchPlan.hpp"
 
 namespace vflib
 {
@@ -27,6 +23,10 @@ namespace vflib
  * class VF3ParallelSubState
  * A representation of the SSR current state
  * See vf2_state.cc for more details.
+ * The read-only data (order, predecessors, directions and
+ * classes) live in a VF3MatchPlan, built by the initial state
+ * and shared by all its copies. A copy only carries the
+ * core sets and must not outlive the initial state.
  ---------------------------------------------------------*/
 template <typename Node1, typename Node2,
 typename Edge1, typename Edge2,
@@ -46,56 +46,74 @@ private:
   //Size of each graph
   int n1, n2;
 
-  nodeID_t *order;     //Order to traverse node on the first graph
+  VF3MatchPlan *plan;  //Shared read-only data
+  bool owns_plan;
 
   //CORE SET SIZES
   int core_len;       //Current length of the core set
   int orig_core_len;  //Core set length of the previous state
-  //int *core_len_c;    //Core set length for each class
 
   int added_node1;    //Last added node
 
-  //nodeID_t* predecessors;  //Previous node in the ordered sequence connected to a node
-
-  std::vector<nodeID_t> core_1;
-  std::vector<nodeID_t> core_2;
-  std::vector<int32_t> core_len_c;
-  std::vector<nodeID_t> predecessors;
-  std::vector<node_dir_t> dir;
+  //The core sets are stored in a single contiguous block of StorageSize()
+  //bytes, either owned by the state or provided by an allocator
+  nodeID_t* core_1;
+  nodeID_t* core_2;
+  bool owns_storage;
 
   //Vector of sets used for searching the successors
   //Each class has its set
   int last_candidate_index;
 
-  /* Structures for classes */
-  uint32_t *class_1;       //Classes for nodes of the first graph
-  uint32_t *class_2;       //Classes for nodes of the first graph
-  uint32_t classes_count;  //Number of classes
-
   //PRIVATE METHODS
   void BackTrack();
-  void ComputeFirstGraphTraversing();
   void print_terminal(int c);
+  void SetStorage(void* storage);
+  void CopyFrom(const VF3ParallelSubState &state);
 
 public:
   static long long instance_count;
-  VF3ParallelSubState(){}
+  VF3ParallelSubState():plan(NULL), owns_plan(false), owns_storage(false){}
   VF3ParallelSubState(ARGraph<Node1, Edge1> *g1, ARGraph<Node2, Edge2> *g2,
 		  uint32_t* class_1, uint32_t* class_2, uint32_t nclass,
                 nodeID_t* order = NULL);
   VF3ParallelSubState(const VF3ParallelSubState &state);
-  ~VF3ParallelSubState(){}
+  VF3ParallelSubState(const VF3ParallelSubState &state, void* storage);
+  ~VF3ParallelSubState()
+  {
+    if(owns_storage)
+      delete [] (char*)core_1;
+    if(owns_plan)
+      delete plan;
+  }
   VF3ParallelSubState& operator=(const VF3ParallelSubState& state);
   ARGraph<Node1, Edge1> *GetGraph1() { return g1; }
   ARGraph<Node2, Edge2> *GetGraph2() { return g2; }
+  //Replaces the target graph with an identical copy, e.g. a replica local to a NUMA node
+  void SetGraph2(ARGraph<Node2, Edge2> *g) { assert(g->NodeCount() == (uint32_t)n2); g2 = g; }
   bool NextPair(nodeID_t *pn1, nodeID_t *pn2, nodeID_t prev_n1=NULL_NODE, nodeID_t prev_n2=NULL_NODE);
   bool IsFeasiblePair(nodeID_t n1, nodeID_t n2);
   void AddPair(nodeID_t n1, nodeID_t n2);
+  void RemovePair(nodeID_t n1, nodeID_t n2);
   inline bool IsGoal() { return core_len==n1; };
   inline bool IsDead(){return false; };
 
   int CoreLen() { return core_len; }
-  
+
+  //Position of NextPair in the candidates of the current depth,
+  //saved and restored by the engines exploring a single state in place
+  inline int GetCandidateCursor() const { return last_candidate_index; }
+  inline void SetCandidateCursor(int cursor) { last_candidate_index = cursor; }
+
+  /*
+  * Size in bytes of the block holding the core sets of the state.
+  * A copy can be built in a block of this size by the copy constructor taking the storage.
+  */
+  inline size_t StorageSize() const
+  {
+    return (n1 + n2) * sizeof(nodeID_t);
+  }
+
   inline void GetCoreSet(std::vector<std::pair<nodeID_t, nodeID_t> >& core)
 	{
 		uint32_t i;
@@ -120,12 +138,7 @@ typename Edge1, typename Edge2,
 typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
 VF3ParallelSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>
 	::VF3ParallelSubState(ARGraph<Node1, Edge1> *ag1, ARGraph<Node2, Edge2> *ag2,
-			uint32_t* class_1, uint32_t* class_2, uint32_t nclass, nodeID_t* order):
-	 core_1(ag1->NodeCount()),
-	 core_2(ag2->NodeCount()),
-	 core_len_c(nclass),
-	 predecessors(ag1->NodeCount()),
-	 dir(ag1->NodeCount())
+			uint32_t* class_1, uint32_t* class_2, uint32_t nclass, nodeID_t* order)
 {
   assert(class_1!=NULL && class_2!=NULL);
 
@@ -135,58 +148,96 @@ VF3ParallelSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparison
   n2=g2->NodeCount();
   last_candidate_index = 0;
 
-  this->order = order;
-  this->class_1 = class_1;
-  this->class_2 = class_2;
-  this->classes_count = nclass;
   core_len=orig_core_len=0;
 
   added_node1=NULL_NODE;
 
+  plan = new VF3MatchPlan(g1, n2, class_1, class_2, nclass, order);
+  owns_plan = true;
+
+  SetStorage(new char[StorageSize()]);
+  owns_storage = true;
+
   int i;
   for(i=0; i<n1; i++)
-  {
-      core_1[i]=NULL_NODE;
-      dir[i] = NODE_DIR_NONE;
-      predecessors[i] = NULL_NODE;
-  }
+    core_1[i]=NULL_NODE;
 
   for(i=0; i<n2; i++)
     core_2[i]=NULL_NODE;
+}
 
-  ComputeFirstGraphTraversing();
+
+/*----------------------------------------------------------
+ * VF3ParallelSubState::SetStorage(storage)
+ * Lays out the core sets of the state in the given block.
+ ---------------------------------------------------------*/
+template <typename Node1, typename Node2,
+typename Edge1, typename Edge2,
+typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+void VF3ParallelSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>
+	::SetStorage(void* storage)
+{
+  core_1 = (nodeID_t*)storage;
+  core_2 = core_1 + n1;
 }
 
 
 /*----------------------------------------------------------
- * VF3ParallelSubState::VF3ParallelSubState(state)
- * Copy constructor.
+ * VF3ParallelSubState::CopyFrom(state)
+ * Copies the scalar members of a state and shares its plan.
  ---------------------------------------------------------*/
 template <typename Node1, typename Node2,
 typename Edge1, typename Edge2,
 typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
-VF3ParallelSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>::
-	VF3ParallelSubState(const VF3ParallelSubState &state):
-  //Qui clono tutti gli insiemi
-	core_1(state.core_1), core_2(state.core_2), core_len_c(state.core_len_c),
-	predecessors(state.predecessors), dir(state.dir)
+void VF3ParallelSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>
+	::CopyFrom(const VF3ParallelSubState &state)
 {
-  //*this = state;
   g1=state.g1;
   g2=state.g2;
   n1=state.n1;
   n2=state.n2;
 
-  order=state.order;
-  class_1 = state.class_1;
-  class_2 = state.class_2;
-  classes_count = state.classes_count;
+  plan=state.plan;
+  owns_plan=false;
   last_candidate_index = state.last_candidate_index;
   core_len=orig_core_len=state.core_len;
   added_node1=NULL_NODE;
 }
 
 
+/*----------------------------------------------------------
+ * VF3ParallelSubState::VF3ParallelSubState(state)
+ * Copy constructor.
+ ---------------------------------------------------------*/
+template <typename Node1, typename Node2,
+typename Edge1, typename Edge2,
+typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+VF3ParallelSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>::
+	VF3ParallelSubState(const VF3ParallelSubState &state):
+	owns_plan(false), owns_storage(false)
+{
+  *this = state;
+}
+
+
+/*----------------------------------------------------------
+ * VF3ParallelSubState::VF3ParallelSubState(state, storage)
+ * Copy constructor building the copy in a block provided
+ * by the caller, which must be at least StorageSize() bytes.
+ * The block is not released by the destructor.
+ ---------------------------------------------------------*/
+template <typename Node1, typename Node2,
+typename Edge1, typename Edge2,
+typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+VF3ParallelSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>::
+	VF3ParallelSubState(const VF3ParallelSubState &state, void* storage)
+{
+  CopyFrom(state);
+  SetStorage(storage);
+  owns_storage = false;
+  std::memcpy(storage, state.core_1, StorageSize());
+}
+
 
 template <typename Node1, typename Node2,
 typename Edge1, typename Edge2,
@@ -197,122 +248,19 @@ VF3ParallelSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparison
 {
 	if(this != &state)
 	{
-	  core_1.empty();
-	  core_2.empty();
-	  core_len_c.empty();
-	  predecessors.empty();
-	  dir.empty();
-
-	  core_1.insert(core_1.begin(), state.core_1.begin(), state.core_1.end());
-	  core_2.insert(core_2.begin(), state.core_2.begin(), state.core_2.end());
-	  core_len_c.insert(core_len_c.begin(), state.core_len_c.begin(), state.core_len_c.end());
-	  predecessors.insert(predecessors.begin(), state.predecessors.begin(), state.predecessors.end());
-	  dir.insert(dir.begin(), state.dir.begin(), state.dir.end());
-
-	  g1=state.g1;
-	  g2=state.g2;
-	  n1=state.n1;
-	  n2=state.n2;
-
-	  order=state.order;
-	  class_1 = state.class_1;
-	  class_2 = state.class_2;
-	  classes_count = state.classes_count;
-	  last_candidate_index = state.last_candidate_index;
-	  core_len=orig_core_len=state.core_len;
+	  if(owns_storage)
+	    delete [] (char*)core_1;
+	  if(owns_plan)
+	    delete plan;
+
+	  CopyFrom(state);
+	  SetStorage(new char[StorageSize()]);
+	  owns_storage = true;
+	  std::memcpy(core_1, state.core_1, StorageSize());
 	}
 	return *this;
 }
 
-//Provare ad avere in1 ed ou1 predeterminati, senza doverlo calcolare ad ogni iterazione
-//La loro dimensione ad ogni livello dell'albero di ricerca e' predeterminato
-//In questo modo mi basta conoscere solo l'ordine di scelta e la dimensione di in1 ed out1
-template <typename Node1, typename Node2,
-typename Edge1, typename Edge2,
-typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
-void VF3ParallelSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeComparisonFunctor>::ComputeFirstGraphTraversing(){
-  //The algorithm start with the node with the maximum degree
-  nodeID_t depth, i;
-  nodeID_t node;	//Current Node
-  int node_c; //Class of the current node
-  bool* inserted = new bool[n1];
-  bool *in, *out; //Internal Terminal Set used for updating the size of
-  in = new bool[n1];
-  out = new bool[n1];
-
-  //Init vectors and variables
-  node = 0;
-  node_c = 0;
-
-  for(i = 0; i < n1; i++)
-    {
-    in[i] = false;
-    out[i] = false;
-    inserted[i] = false;
-    }
-
-  /* Following the imposed node order */
-  for(depth = 0; depth < n1; depth++)
-    {
-    node = order[depth];
-    node_c = class_1[node];
-    inserted[node] = true;
-
-    //Inserting the node
-    //Terminal set sizes depends on the depth
-    // < depth non sono nell'insieme
-    // >= depth sono nell'insieme
-    if (!in[node])
-      in[node]=true;
-
-    if (!out[node])
-      out[node]=true;
-
-    //Updating terminal sets
-    int i, other, other_c;
-    other_c = -1;
-    for(i=0; i<g1->InEdgeCount(node); i++)
-      {
-      other=g1->GetInEdge(node, i);
-      if (!in[other])
-        {
-        other_c = class_1[other];
-        in[other]=true;
-        if(!inserted[other])
-        {
-          if(predecessors[other] == NULL_NODE)
-          {
-            dir[other] = NODE_DIR_IN;
-            predecessors[other] = node;
-          }
-        }
-        }
-      }
-
-    for(i=0; i<g1->OutEdgeCount(node); i++)
-      {
-      other=g1->GetOutEdge(node, i);
-      if (!out[other])
-        {
-        other_c = class_1[other];
-        out[other]=true;
-        if(!inserted[other])
-        {
-          if(predecessors[other] == NULL_NODE)
-          {
-            predecessors[other] = node;
-            dir[other] = NODE_DIR_OUT;
-          }
-        }
-        }
-      }
-    }
-
-  delete [] in;
-  delete [] out;
-  delete [] inserted;
-}
-
 template <typename Node1, typename Node2,
 typename Edge1, typename Edge2,
 typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
@@ -323,14 +271,16 @@ bool VF3ParallelSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeCompa
   nodeID_t curr_n1;
   nodeID_t pred_pair; //Node mapped with the predecessor
   nodeID_t pred_set_size = 0;
+  const nodeID_t *pred_set = NULL;
   int c = 0;
   pred_pair = NULL_NODE;
+  const uint32_t *class_2 = plan->class_2;
 
   //core_len indica la profondondita' della ricerca
-  curr_n1 = order[core_len];
-  c = class_1[curr_n1];
+  curr_n1 = plan->order[core_len];
+  c = plan->class_1[curr_n1];
 
-  if(predecessors[curr_n1] != NULL_NODE)
+  if(plan->predecessors[curr_n1] != NULL_NODE)
     {
     if (prev_n2 == NULL_NODE)
       last_candidate_index = 0;
@@ -338,40 +288,41 @@ bool VF3ParallelSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeCompa
       last_candidate_index++; //Next Element
     }
 
-    pred_pair = core_1[predecessors[curr_n1]];
-    switch (dir[curr_n1])
+    pred_pair = core_1[plan->predecessors[curr_n1]];
+    switch (plan->dir[curr_n1])
       {
         case NODE_DIR_IN:
-        pred_set_size = g2->InEdgeCount(pred_pair);
-
-        while(last_candidate_index < pred_set_size)
+        if(g2->HasClassIndex())
+          pred_set = g2->GetInEdgeSetOfClass(pred_pair, c, pred_set_size);
+        else
           {
-            prev_n2 = g2->GetInEdge(pred_pair,last_candidate_index);
-            if(core_2[prev_n2] != NULL_NODE || class_2[prev_n2] != c)
-              last_candidate_index++;
-            else
-              break;
+          pred_set_size = g2->InEdgeCount(pred_pair);
+          pred_set = g2->GetInEdgeSet(pred_pair);
           }
 
         break;
 
         case NODE_DIR_OUT:
-        pred_set_size = g2->OutEdgeCount(pred_pair);
-
-        while(last_candidate_index < pred_set_size)
+        if(g2->HasClassIndex())
+          pred_set = g2->GetOutEdgeSetOfClass(pred_pair, c, pred_set_size);
+        else
           {
-            prev_n2 = g2->GetOutEdge(pred_pair,last_candidate_index);
-            if(core_2[prev_n2] != NULL_NODE || class_2[prev_n2] != c)
-              last_candidate_index++;
-            else
-              break;
+          pred_set_size = g2->OutEdgeCount(pred_pair);
+          pred_set = g2->GetOutEdgeSet(pred_pair);
           }
 
         break;
       }
 
+    //With the slices sorted by degree the candidates too small for curr_n1 are a suffix
+    if(g2->HasClassIndex() && g2->ClassIndexByDegree())
+      pred_set_size = g2->DegreeCutoff(pred_set, pred_set_size, g1->EdgeCount(curr_n1));
+
+    last_candidate_index = NextCandidate(pred_set, last_candidate_index, pred_set_size,
+      core_2, class_2, c);
     if(last_candidate_index >= pred_set_size)
       return false;
+    prev_n2 = pred_set[last_candidate_index];
 
     }
   else
@@ -382,12 +333,7 @@ bool VF3ParallelSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeCompa
     else
       prev_n2++;
 
-    while (prev_n2<n2 &&
-           (core_2[prev_n2]!=NULL_NODE
-            || class_2[prev_n2] != c) )
-      {
-      prev_n2++;
-      }
+    prev_n2 = NextFreeCandidate(prev_n2, n2, core_2, class_2, c);
     }
   //std::cout<<curr_n1 << " " << prev_n2 << " \n";
 
@@ -425,37 +371,38 @@ bool VF3ParallelSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeCompa
   assert(core_1[node1]==NULL_NODE);
   assert(core_2[node2]==NULL_NODE);
 
-  if(!nf(g1->GetNodeAttr(node1), g2->GetNodeAttr(node2)))
+  if(!TrivialComparison<Node1, Node2, NodeComparisonFunctor>::value &&
+     !nf(g1->GetNodeAttr(node1), g2->GetNodeAttr(node2)))
     return false;
 
   if(g1->InEdgeCount(node1) > g2->InEdgeCount(node2)
     || g1->OutEdgeCount(node1) > g2->OutEdgeCount(node2))
     return false;
 
-  int i, other1, other2, c_other;
+  int i, other1, other2;
   Edge1 eattr1;
   Edge2 eattr2;
+  //Without attributes to compare the edges are only looked up
+  const bool edge_attr = !TrivialComparison<Edge1, Edge2, EdgeComparisonFunctor>::value;
 
   // Check the 'out' edges of node1
   for(i=0; i<g1->OutEdgeCount(node1); i++)
-    { other1=g1->GetOutEdge(node1, i, eattr1);
-      c_other = class_1[other1];
+    { other1 = edge_attr ? g1->GetOutEdge(node1, i, eattr1) : g1->GetOutEdge(node1, i);
       if (core_1[other1] != NULL_NODE)
         { other2=core_1[other1];
-          if (!g2->HasEdge(node2, other2, eattr2) ||
-              !ef(eattr1, eattr2))
+          if (edge_attr ? (!g2->HasEdge(node2, other2, eattr2) || !ef(eattr1, eattr2))
+                        : !g2->HasEdge(node2, other2))
             return false;
         }
     }
 
   // Check the 'in' edges of node1
   for(i=0; i<g1->InEdgeCount(node1); i++)
-    { other1=g1->GetInEdge(node1, i, eattr1);
-      c_other = class_1[other1];
+    { other1 = edge_attr ? g1->GetInEdge(node1, i, eattr1) : g1->GetInEdge(node1, i);
       if (core_1[other1]!=NULL_NODE)
         { other2=core_1[other1];
-          if (!g2->HasEdge(other2, node2, eattr2) ||
-              !ef(eattr1, eattr2))
+          if (edge_attr ? (!g2->HasEdge(other2, node2, eattr2) || !ef(eattr1, eattr2))
+                        : !g2->HasEdge(other2, node2))
             return false;
         }
     }
@@ -464,7 +411,6 @@ bool VF3ParallelSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeCompa
   // Check the 'out' edges of node2
   for(i=0; i<g2->OutEdgeCount(node2); i++)
     { other2=g2->GetOutEdge(node2, i);
-      c_other = class_2[other2];
       if (core_2[other2]!=NULL_NODE)
         { other1=core_2[other2];
           if (!g1->HasEdge(node1, other1))
@@ -475,7 +421,6 @@ bool VF3ParallelSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,EdgeCompa
   // Check the 'in' edges of node2
   for(i=0; i<g2->InEdgeCount(node2); i++)
     { other2=g2->GetInEdge(node2, i);
-      c_other = class_2[other2];
       if (core_2[other2] != NULL_NODE)
         { other1=core_2[other2];
           if (!g1->HasEdge(other1, node1))
@@ -510,13 +455,11 @@ EdgeComparisonFunctor>::AddPair(nodeID_t node1, nodeID_t node2)
   assert(node2<n2);
   assert(core_len<n1);
   assert(core_len<n2);
-  assert(class_1[node1] == class_2[node2]);
+  assert(plan->class_1[node1] == plan->class_2[node2]);
 
   //Updating the core length
   core_len++;
   added_node1=node1;
-  int node_c = class_1[node1];
-  core_len_c[node_c]++;
 
   //Inserting nodes into the core set
   core_1[node1]=node2;
@@ -524,5 +467,25 @@ EdgeComparisonFunctor>::AddPair(nodeID_t node1, nodeID_t node2)
 
 }
 
+
+/*--------------------------------------------------------------
+ * void VF3ParallelSubState::RemovePair(node1, node2)
+ * Removes from the core set the last pair added by AddPair.
+ -------------------------------------------------------------*/
+template <typename Node1, typename Node2,
+typename Edge1, typename Edge2,
+typename NodeComparisonFunctor, typename EdgeComparisonFunctor>
+void VF3ParallelSubState<Node1,Node2,Edge1,Edge2,NodeComparisonFunctor,
+EdgeComparisonFunctor>::RemovePair(nodeID_t node1, nodeID_t node2)
+{
+  assert(core_len>0);
+  assert(plan->order[core_len-1] == node1);
+  assert(core_1[node1] == node2);
+
+  core_len--;
+  core_1[node1]=NULL_NODE;
+  core_2[node2]=NULL_NODE;
+}
+
 }
 #endif
@@ -0,0 +1,181 @@
+/*
+ * WorkStealingDeque.hpp
+ */
+
+/*
+* Lock-free Chase-Lev work stealing deque.
+* The owner thread pushes and pops at the bottom, any other thread can steal from the top.
+* Implementation follows "Correct and Efficient Work-Stealing for Weak Memory Models"
+* (Le, Pop, Cohen, Zappa Nardelli - PPoPP 2013).
+*/
+
+#ifndef WORKSTEALINGDEQUE_HPP
+#define WORKSTEALINGDEQUE_HPP
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+namespace vflib {
+
+#define WS_CACHE_LINE_SIZE 64
+
+template<typename T>
+class WorkStealingDeque
+{
+private:
+	/*
+	* Circular buffer of the deque. Its size is always a power of two.
+	* Buffers replaced by a grow are kept alive until the deque is destroyed,
+	* because a thief could still be reading from them.
+	*/
+	class Array
+	{
+	private:
+		int64_t mask;
+		std::atomic<T>* items;
+
+	public:
+		Array(int64_t size): mask(size - 1), items(new std::atomic<T>[size]) {}
+		~Array() { delete[] items; }
+
+		inline int64_t Capacity() const { return mask + 1; }
+
+		inline T Get(int64_t i) const
+		{
+			return items[i & mask].load(std::memory_order_relaxed);
+		}
+
+		inline void Put(int64_t i, T x)
+		{
+			items[i & mask].store(x, std::memory_order_relaxed);
+		}
+
+		Array* Grow(int64_t bottom, int64_t top) const
+		{
+			Array* a = new Array(Capacity() << 1);
+			for (int64_t i = top; i < bottom; i++)
+			{
+				a->Put(i, Get(i));
+			}
+			return a;
+		}
+	};
+
+	std::atomic<int64_t> top;
+	char pad0[WS_CACHE_LINE_SIZE - sizeof(std::atomic<int64_t>)];
+	std::atomic<int64_t> bottom;
+	char pad1[WS_CACHE_LINE_SIZE - sizeof(std::atomic<int64_t>)];
+	std::atomic<Array*> array;
+	std::vector<Array*> retired;	//Accessed by the owner only
+
+public:
+	WorkStealingDeque(int64_t capacity = 1024): top(0), bottom(0)
+	{
+		int64_t size = 1;
+		while (size < capacity)
+		{
+			size <<= 1;
+		}
+		array.store(new Array(size), std::memory_order_relaxed);
+	}
+
+	~WorkStealingDeque()
+	{
+		for (size_t i = 0; i < retired.size(); i++)
+		{
+			delete retired[i];
+		}
+		delete array.load(std::memory_order_relaxed);
+	}
+
+	/*
+	* @brief Approximated number of items in the deque
+	*/
+	inline int64_t Size() const
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_relaxed);
+		return b > t ? b - t : 0;
+	}
+
+	inline bool Empty() const
+	{
+		return Size() == 0;
+	}
+
+	/*
+	* @brief Pushes an item at the bottom of the deque. Owner only.
+	*/
+	void Push(T x)
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_acquire);
+		Array* a = array.load(std::memory_order_relaxed);
+		if (b - t > a->Capacity() - 1)
+		{
+			retired.push_back(a);
+			a = a->Grow(b, t);
+			array.store(a, std::memory_order_release);
+		}
+		a->Put(b, x);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+
+	/*
+	* @brief Pops an item from the bottom of the deque. Owner only.
+	* @return FALSE if the deque is empty
+	*/
+	bool Pop(T& x)
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		Array* a = array.load(std::memory_order_relaxed);
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_relaxed);
+
+		if (t > b)
+		{
+			//Empty deque
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		x = a->Get(b);
+		if (t == b)
+		{
+			//Last item, racing with the thieves
+			bool won = top.compare_exchange_strong(t, t + 1,
+				std::memory_order_seq_cst, std::memory_order_relaxed);
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+		return true;
+	}
+
+	/*
+	* @brief Steals an item from the top of the deque. Any thread.
+	* @return FALSE if the deque is empty or the steal has been lost against another thread
+	*/
+	bool Steal(T& x)
+	{
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_acquire);
+
+		if (t >= b)
+		{
+			return false;
+		}
+
+		Array* a = array.load(std::memory_order_acquire);
+		x = a->Get(t);
+		return top.compare_exchange_strong(t, t + 1,
+			std::memory_order_seq_cst, std::memory_order_relaxed);
+	}
+};
+
+}
+
+#endif /* WORKSTEALINGDEQUE_HPP */
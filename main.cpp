@@ -2,7 +2,10 @@
 #include <iostream>
 #include <fstream>
 #include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
 #include <string>
+#include <memory>
 #include <time.h>
 #ifndef WIN32
 #include <unistd.h>
@@ -14,6 +17,8 @@
 
 #include "ARGLoader.hpp"
 #include "ARGraph.hpp"
+#include "GraphFormats.hpp"
+#include "GraphReordering.hpp"
 #include "NodeSorter.hpp"
 #include "VF3NodeSorter.hpp"
 #include "RINodeSorter.hpp"
@@ -25,6 +30,7 @@
 #include "VF3KSubState.hpp"
 #include "VF3LightSubState.hpp"
 #include "parallel/VF3ParallelSubState.hpp"
+#include "parallel/VF3ParallelCompactSubState.hpp"
 
 using namespace vflib;
 
@@ -38,14 +44,33 @@ typedef int32_t data_t;
 typedef std::string data_t;
 #endif
 
+//VF3P_COMPACT selects the parallel states storing only the path of the search
+#ifndef VF3P_COMPACT
+typedef VF3ParallelSubState<data_t, data_t, Empty, Empty> parallel_state_t;
+#else
+typedef VF3ParallelCompactSubState<data_t, data_t, Empty, Empty> parallel_state_t;
+#endif
+
 #if defined(VF3PV1)
 #include "parallel/ParallelMatchingEngine.hpp"
-typedef VF3ParallelSubState<data_t, data_t, Empty, Empty> state_t;
+typedef parallel_state_t state_t;
 #define MATCHING_INIT ParallelMatchingEngine<state_t > me(numOfThreads, false, cpu)
 #elif defined(VF3PV2)
 #include "parallel/ParallelMatchingEngineWLS.hpp"
-typedef VF3ParallelSubState<data_t, data_t, Empty, Empty> state_t;
-#define MATCHING_INIT ParallelMatchingEngineWLS<state_t > me(numOfThreads, false, cpu, 3, n1)
+typedef parallel_state_t state_t;
+#define MATCHING_INIT ParallelMatchingEngineWLS<state_t > me(numOfThreads, false, cpu)
+#elif defined(VF3PV3)
+#include "parallel/ParallelMatchingEngineWS.hpp"
+typedef parallel_state_t state_t;
+#define MATCHING_INIT ParallelMatchingEngineWS<state_t > me(numOfThreads, false, cpu)
+#elif defined(VF3PV4)
+#include "parallel/ParallelMatchingEngineDFS.hpp"
+typedef parallel_state_t state_t;
+#define MATCHING_INIT ParallelMatchingEngineDFS<state_t > me(numOfThreads, false, cpu)
+#elif defined(VF3PS)
+#include "parallel/ParallelMatchingEngineShard.hpp"
+typedef VF3LightSubState<data_t, data_t, Empty, Empty> state_t;
+#define MATCHING_INIT ParallelMatchingEngineShard<state_t > me(numOfThreads, false, cpu, shardIndex, shardCount, shardDepth)
 #elif defined(VF3L)
 typedef VF3LightSubState<data_t, data_t, Empty, Empty> state_t;
 #define MATCHING_INIT MatchingEngine<state_t > me(true)
@@ -76,6 +101,24 @@ int gettimeofday(struct timeval * tp, struct timezone * tzp)
 
 static long long state_counter = 0;
 
+static void PrintUsage()
+{
+#ifndef VF3L
+	std::cout << "Usage: vf3 [pattern] [target] [num of threads (opt)] [cpu (opt)]";
+#ifdef VF3PS
+	std::cout << " [--shard i/N (opt)] [--shard-depth d (opt)]";
+#else
+	std::cout << " [--numa (opt)] [--numa-replicate (opt)] [--first-k k (opt)] [--cycles (opt)] [--degree-order (opt)]";
+#endif
+	std::cout << " [--reorder none|degree|rcm|gorder (opt)] [--low-memory (opt)]";
+	std::cout << " [--format auto|grf|edgelist|mtx|lad|mivia16|mivia32 (opt)]";
+	std::cout << "\n";
+#else
+	std::cout << "Usage: vf3 [pattern] [target] [--reorder none|degree|rcm|gorder (opt)] [--low-memory (opt)]";
+	std::cout << " [--format auto|grf|edgelist|mtx|lad|mivia16|mivia32 (opt)]\n";
+#endif
+}
+
 int32_t main(int32_t argc, char** argv)
 {
 
@@ -89,50 +132,221 @@ int32_t main(int32_t argc, char** argv)
 
 	state_counter = 0;
 	size_t sols = 0;
+	ReorderingMethod reorder = REORDER_NONE;
+	bool degreeOrder = false;
+	bool lowMemory = false;
+	GraphFormat format = FORMAT_AUTO;
 #ifndef VF3L
 	if (argc < 3)
 	{
-		std::cout << "Usage: vf3 [pattern] [target] [num of threads (opt)] [cpu (opt)]\n";
+		PrintUsage();
 		return -1;
 	}
 
-	numOfThreads = atoi(argv[3]);
-	cpu = atoi(argv[4]);
+	//The number of threads and the cpu, when given, precede the options
+	int i = 3;
+	if (i < argc && strncmp(argv[i], "--", 2))
+		numOfThreads = atoi(argv[i++]);
+	if (i < argc && strncmp(argv[i], "--", 2))
+		cpu = atoi(argv[i++]);
+#ifdef VF3PS
+	uint32_t shardIndex = 0, shardCount = 1;
+	uint16_t shardDepth = 1;
+#else
+	bool numaPlacement = false, numaReplicate = false;
+	uint32_t firstK = 0;
+	bool printCycles = false;
+#endif
+	for (; i < argc; i++)
+	{
+		std::string option(argv[i]);
+		if (option == "--reorder" && i + 1 < argc)
+		{
+			if (!ParseReorderingMethod(argv[++i], reorder))
+			{
+				std::cout << "Invalid ordering " << argv[i] << "\n";
+				return -1;
+			}
+		}
+		else if (option == "--low-memory")
+		{
+			lowMemory = true;
+		}
+		else if (option == "--format" && i + 1 < argc)
+		{
+			if (!ParseGraphFormat(argv[++i], format))
+			{
+				std::cout << "Invalid format " << argv[i] << "\n";
+				return -1;
+			}
+		}
+#ifdef VF3PS
+		else if (option == "--shard" && i + 1 < argc)
+		{
+			i++;
+			if (sscanf(argv[i], "%u/%u", &shardIndex, &shardCount) != 2 ||
+				shardCount == 0 || shardIndex >= shardCount)
+			{
+				std::cout << "Invalid shard " << argv[i] << ", expected i/N with 0 <= i < N\n";
+				return -1;
+			}
+		}
+		else if (option == "--shard-depth" && i + 1 < argc)
+		{
+			//Checked against the size of the pattern once it is loaded
+			i++;
+			int depth;
+			char trailing;
+			if (sscanf(argv[i], "%d%c", &depth, &trailing) != 1 || depth < 1 || depth > UINT16_MAX)
+			{
+				std::cout << "Invalid shard depth " << argv[i] << ", expected 1 <= d <= pattern size\n";
+				return -1;
+			}
+			shardDepth = depth;
+		}
+#else
+		else if (option == "--numa")
+		{
+			numaPlacement = true;
+		}
+		else if (option == "--numa-replicate")
+		{
+			numaReplicate = true;
+		}
+		else if (option == "--first-k" && i + 1 < argc)
+		{
+			i++;
+			char *end;
+			unsigned long k = strtoul(argv[i], &end, 10);
+			if (!isdigit((unsigned char)argv[i][0]) || *end || k < 1 || k > UINT32_MAX)
+			{
+				std::cout << "Invalid number of solutions " << argv[i] << ", expected k >= 1\n";
+				return -1;
+			}
+			firstK = k;
+		}
+		else if (option == "--cycles")
+		{
+			printCycles = true;
+		}
+		else if (option == "--degree-order")
+		{
+			//Only the parallel states use the degree cutoff, VF3L needs the slices sorted by node
+			degreeOrder = true;
+		}
+#endif
+		else
+		{
+			//Unknown option, or option missing its value
+			std::cout << "Invalid option " << argv[i] << "\n";
+			PrintUsage();
+			return -1;
+		}
+	}
 #else
 	if (argc < 2)
 	{
-		std::cout << "Usage: vf3 [pattern] [target] \n";
+		PrintUsage();
 		return -1;
 	}
+
+	//The number of threads and the cpu of the parallel versions are accepted and ignored
+	int i = 3;
+	for (int skipped = 0; skipped < 2 && i < argc && strncmp(argv[i], "--", 2); skipped++)
+		i++;
+	for (; i < argc; i++)
+	{
+		std::string option(argv[i]);
+		if (option == "--reorder" && i + 1 < argc)
+		{
+			if (!ParseReorderingMethod(argv[++i], reorder))
+			{
+				std::cout << "Invalid ordering " << argv[i] << "\n";
+				return -1;
+			}
+		}
+		else if (option == "--format" && i + 1 < argc)
+		{
+			if (!ParseGraphFormat(argv[++i], format))
+			{
+				std::cout << "Invalid format " << argv[i] << "\n";
+				return -1;
+			}
+		}
+		else if (option == "--low-memory")
+		{
+			lowMemory = true;
+		}
+		else
+		{
+			//Unknown option, or option missing its value
+			std::cout << "Invalid option " << argv[i] << "\n";
+			PrintUsage();
+			return -1;
+		}
+	}
 #endif
 	pattern = argv[1];
 	target = argv[2];
 
-	std::ifstream graphInPat(pattern);
-	std::ifstream graphInTarg(target);
-
 	std::vector<MatchingSolution> solutions;
 
-	StreamARGLoader<data_t, Empty> pattloader(graphInPat);
-	StreamARGLoader<data_t, Empty> targloader(graphInTarg);
-
-	ARGraph<data_t, Empty> patt_graph(&pattloader);
-	ARGraph<data_t, Empty> targ_graph(&targloader);
+	std::unique_ptr<ARGraph<data_t, Empty> > patt_ptr(LoadGraph<data_t, Empty>(pattern, format, numOfThreads, lowMemory));
+	ARGraph<data_t, Empty> &patt_graph = *patt_ptr;
+	std::unique_ptr<ARGraph<data_t, Empty> > targ_ptr(LoadGraph<data_t, Empty>(target, format, numOfThreads, lowMemory));
+	//The target is matched relabeled, targ_order maps its nodes back to the file ids
+	std::vector<nodeID_t> targ_order;
+	if (reorder != REORDER_NONE)
+	{
+		targ_order = ComputeReordering(*targ_ptr, reorder);
+		RelabeledARGLoader<data_t, Empty> relabeler(*targ_ptr, targ_order);
+		targ_ptr.reset(new ARGraph<data_t, Empty>(&relabeler, numOfThreads));
+	}
+	ARGraph<data_t, Empty> &targ_graph = *targ_ptr;
+	//The bit matrix is used when the graphs are small and dense enough, the index otherwise
+	patt_graph.BuildAdjacencyMatrix();
+	if (!targ_graph.BuildAdjacencyMatrix())
+		targ_graph.BuildAdjacencyIndex();
 
         n1 = patt_graph.NodeCount();
+#ifdef VF3PS
+	if (shardDepth > n1)
+	{
+		std::cout << "Invalid shard depth " << shardDepth << ", expected 1 <= d <= pattern size (" << n1 << ")\n";
+		return -1;
+	}
+#endif
 
 	NodeClassifier<data_t, Empty> classifier(&targ_graph);
 	NodeClassifier<data_t, Empty> classifier2(&patt_graph, classifier);
 	std::vector<uint32_t> class_patt = classifier2.GetClasses();
 	std::vector<uint32_t> class_targ = classifier.GetClasses();
+	//With more than a class the candidates are taken from the neighbors of their class,
+	//with the degree order the neighbors too small for the pattern node are skipped
+	if (classifier.CountClasses() > 1 || degreeOrder)
+		targ_graph.BuildClassIndex(class_targ.data(), degreeOrder);
 
 	MATCHING_INIT;
+#if !defined(VF3L) && !defined(VF3PS)
+	me.SetNumaPolicy(numaPlacement, numaReplicate);
+#endif
 	VF3NodeSorter<data_t, Empty, SubIsoNodeProbability<data_t, Empty> > sorter(&targ_graph);
 	std::vector<nodeID_t> sorted = sorter.SortNodes(&patt_graph);
 
 	gettimeofday(&start, NULL);
+#ifdef VF3PS
+	//Each thread builds its own initial state
+	me.FindAllMatchings([&]() {
+		return state_t(&patt_graph, &targ_graph, class_patt.data(), class_targ.data(), classifier.CountClasses(), sorted.data());
+	});
+#else
 	state_t s0(&patt_graph, &targ_graph, class_patt.data(), class_targ.data(), classifier.CountClasses(), sorted.data());
+#ifndef VF3L
+	me.FindFirstK(s0, firstK);
+#else
 	me.FindAllMatchings(s0);
+#endif
+#endif
 	sols = me.GetSolutionsCount();
 
 	gettimeofday(&end,NULL);
@@ -145,6 +359,13 @@ int32_t main(int32_t argc, char** argv)
 	std::vector<MatchingSolution>::iterator it;
 	for(it = solutions.begin(); it != solutions.end(); it++)
 	{
+		if (targ_order.size())
+		{
+			for (size_t i = 0; i < it->size(); i++)
+			{
+				(*it)[i].second = targ_order[(*it)[i].second];
+			}
+		}
 		std::cout<< me.SolutionToString(*it) << std::endl;
 	}
 	/*std::cout << "SORT: ";
@@ -156,6 +377,11 @@ int32_t main(int32_t argc, char** argv)
 	std::cout << "END" << std::endl;*/
 
 	std::cout << sols << " " << timeAll;
+#if !defined(VF3L) && !defined(VF3PS)
+	//Cycles spent by all the workers processing states and waiting for them
+	if (printCycles)
+		std::cout << " " << me.GetBusyCycles() << " " << me.GetIdleCycles();
+#endif
 
 	//system("PAUSE");
 